@@ -427,8 +427,7 @@ BlockDriverState *bdrv_new(void)
 
     qemu_co_queue_init(&bs->flush_queue);
 
-    qemu_co_mutex_init(&bs->bsc_modify_lock);
-    bs->block_status_cache = g_new0(BdrvBlockStatusCache, 1);
+    qemu_mutex_init(&bs->block_status_cache.lock);
 
     for (i = 0; i < bdrv_drain_all_count; i++) {
         bdrv_drained_begin(bs);
@@ -5069,6 +5068,9 @@ static void GRAPH_UNLOCKED bdrv_reopen_commit(BDRVReopenState *reopen_state)
         drv->bdrv_reopen_commit(reopen_state);
     }
 
+    /* The node may now be backed by different files */
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
     GRAPH_RDLOCK_GUARD_MAINLOOP();
 
     /* set BDS specific flags now */
@@ -5158,8 +5160,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->explicit_options = NULL;
     qobject_unref(bs->full_open_options);
     bs->full_open_options = NULL;
-    g_free(bs->block_status_cache);
-    bs->block_status_cache = NULL;
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
 
     bdrv_release_named_dirty_bitmaps(bs);
     assert(QLIST_EMPTY(&bs->dirty_bitmaps));
@@ -5547,6 +5548,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    qemu_mutex_destroy(&bs->block_status_cache.lock);
 
     g_free(bs);
 }
@@ -6907,6 +6909,9 @@ int coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     assert(!(bs->open_flags & BDRV_O_INACTIVE));
     assert_bdrv_graph_readable();
 
+    /* The image may have been changed by another process */
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
     if (bs->drv->bdrv_co_invalidate_cache) {
         bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
         if (local_err) {
@@ -8186,6 +8191,7 @@ int bdrv_make_empty(BdrvChild *c, Error **errp)
     }
 
     ret = drv->bdrv_make_empty(c->bs);
+    bdrv_bsc_invalidate_range(c->bs, 0, INT64_MAX);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Failed to empty %s",
                          c->bs->filename);
@@ -8356,31 +8362,119 @@ BlockDriverState *bdrv_backing_chain_next(BlockDriverState *bs)
     return bdrv_skip_filters(bdrv_cow_bs(bdrv_skip_filters(bs)));
 }
 
+/* Maximum number of regions in the block-status cache of a node */
+#define BDRV_BSC_MAX_ENTRIES 1024
+
+static inline BdrvBlockStatusCacheEntry *bdrv_bsc_entry(IntervalTreeNode *node)
+{
+    return container_of(node, BdrvBlockStatusCacheEntry, node);
+}
+
+/* Called with bsc->lock held */
+static void bdrv_bsc_remove_locked(BdrvBlockStatusCache *bsc,
+                                   IntervalTreeNode *node)
+{
+    interval_tree_remove(node, &bsc->tree);
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries - 1);
+    g_free(bdrv_bsc_entry(node));
+}
+
 /**
- * Check whether [offset, offset + bytes) overlaps with the cached
- * block-status data region.
+ * Check whether @offset is in a cached region of the given type.
  *
- * If so, and @pnum is not NULL, set *pnum to `bsc.data_end - offset`,
- * which is what bdrv_bsc_is_data()'s interface needs.
+ * If so, and @pnum is not NULL, set *pnum to the number of bytes from
+ * @offset to the end of that region.
  * Otherwise, *pnum is not touched.
  */
-static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
-                                           int64_t offset, int64_t bytes,
-                                           int64_t *pnum)
+static bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset, bool data,
+                            int64_t *pnum)
 {
-    BdrvBlockStatusCache *bsc = qatomic_rcu_read(&bs->block_status_cache);
-    bool overlaps;
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    IntervalTreeNode *node;
 
-    overlaps =
-        qatomic_read(&bsc->valid) &&
-        ranges_overlap(offset, bytes, bsc->data_start,
-                       bsc->data_end - bsc->data_start);
+    if (!qatomic_read(&bsc->nb_entries)) {
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&bsc->lock);
 
-    if (overlaps && pnum) {
-        *pnum = bsc->data_end - offset;
+    node = interval_tree_iter_first(&bsc->tree, offset, offset);
+    if (!node || bdrv_bsc_entry(node)->data != data) {
+        return false;
     }
 
-    return overlaps;
+    if (pnum) {
+        *pnum = node->last + 1 - offset;
+    }
+    return true;
+}
+
+/**
+ * Add [offset, offset + bytes) to the cache as a region of the given
+ * type, merging it with overlapping and adjacent regions of the same
+ * type.  Overlapping regions of the other type are replaced.
+ */
+static void bdrv_bsc_insert(BlockDriverState *bs, int64_t offset,
+                            int64_t bytes, bool data,
+                            unsigned int generation)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    BdrvBlockStatusCacheEntry *entry;
+    IntervalTreeNode *node;
+    uint64_t start = offset;
+    uint64_t last = offset + bytes - 1;
+
+    assert(offset >= 0 && bytes > 0);
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+
+    /*
+     * Account for the new entry before checking the generation: Either
+     * bdrv_bsc_invalidate_range() sees it and removes it once we have
+     * dropped the lock, or we see that the cache was invalidated after
+     * the driver had been queried.
+     */
+    qatomic_set(&bsc->nb_entries, bsc->nb_entries + 1);
+    smp_mb();
+    if (qatomic_read(&bsc->generation) != generation) {
+        qatomic_set(&bsc->nb_entries, bsc->nb_entries - 1);
+        return;
+    }
+
+    if (bsc->nb_entries > BDRV_BSC_MAX_ENTRIES) {
+        /* Start over instead of tracking which entries are still useful */
+        while ((node = interval_tree_iter_first(&bsc->tree, 0, INT64_MAX))) {
+            bdrv_bsc_remove_locked(bsc, node);
+        }
+    }
+
+    while ((node = interval_tree_iter_first(&bsc->tree, start, last))) {
+        if (bdrv_bsc_entry(node)->data == data) {
+            start = MIN(start, node->start);
+            last = MAX(last, node->last);
+        }
+        bdrv_bsc_remove_locked(bsc, node);
+    }
+
+    if (start > 0) {
+        node = interval_tree_iter_first(&bsc->tree, start - 1, start - 1);
+        if (node && bdrv_bsc_entry(node)->data == data) {
+            start = node->start;
+            bdrv_bsc_remove_locked(bsc, node);
+        }
+    }
+
+    node = interval_tree_iter_first(&bsc->tree, last + 1, last + 1);
+    if (node && bdrv_bsc_entry(node)->data == data) {
+        last = node->last;
+        bdrv_bsc_remove_locked(bsc, node);
+    }
+
+    entry = g_new0(BdrvBlockStatusCacheEntry, 1);
+    entry->node.start = start;
+    entry->node.last = last;
+    entry->data = data;
+    interval_tree_insert(&entry->node, &bsc->tree);
 }
 
 /**
@@ -8389,8 +8483,17 @@ static bool bdrv_bsc_range_overlaps_locked(BlockDriverState *bs,
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 {
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
-    return bdrv_bsc_range_overlaps_locked(bs, offset, 1, pnum);
+    return bdrv_bsc_lookup(bs, offset, true, pnum);
+}
+
+/**
+ * See block_int.h for this function's documentation.
+ */
+bool bdrv_bsc_is_unallocated(BlockDriverState *bs, int64_t offset,
+                             int64_t *pnum)
+{
+    IO_CODE();
+    return bdrv_bsc_lookup(bs, offset, false, pnum);
 }
 
 /**
@@ -8399,34 +8502,54 @@ bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum)
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes)
 {
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    IntervalTreeNode *node;
+    uint64_t last;
     IO_CODE();
-    RCU_READ_LOCK_GUARD();
 
-    if (bdrv_bsc_range_overlaps_locked(bs, offset, bytes, NULL)) {
-        qatomic_set(&bs->block_status_cache->valid, false);
+    /* Pairs with the smp_mb() in bdrv_bsc_insert() */
+    qatomic_inc(&bsc->generation);
+    smp_mb__after_rmw();
+    if (!qatomic_read(&bsc->nb_entries) || bytes <= 0) {
+        return;
+    }
+
+    last = bytes > INT64_MAX - offset ? INT64_MAX : offset + bytes - 1;
+
+    QEMU_LOCK_GUARD(&bsc->lock);
+    while ((node = interval_tree_iter_first(&bsc->tree, offset, last))) {
+        bdrv_bsc_remove_locked(bsc, node);
     }
 }
 
 /**
  * See block_int.h for this function's documentation.
  */
-void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+unsigned int bdrv_bsc_generation(BlockDriverState *bs)
 {
-    BdrvBlockStatusCache *new_bsc = g_new(BdrvBlockStatusCache, 1);
-    BdrvBlockStatusCache *old_bsc;
     IO_CODE();
+    return qatomic_read(&bs->block_status_cache.generation);
+}
 
-    *new_bsc = (BdrvBlockStatusCache) {
-        .valid = true,
-        .data_start = offset,
-        .data_end = offset + bytes,
-    };
-
-    QEMU_LOCK_GUARD(&bs->bsc_modify_lock);
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    IO_CODE();
+    /*
+     * Reporting zeroes as data is fine, so there is no need to care
+     * about concurrent invalidations here.
+     */
+    bdrv_bsc_insert(bs, offset, bytes, true, bdrv_bsc_generation(bs));
+}
 
-    old_bsc = qatomic_rcu_read(&bs->block_status_cache);
-    qatomic_rcu_set(&bs->block_status_cache, new_bsc);
-    if (old_bsc) {
-        g_free_rcu(old_bsc, rcu);
-    }
+/**
+ * See block_int.h for this function's documentation.
+ */
+void bdrv_bsc_fill_unallocated(BlockDriverState *bs, int64_t offset,
+                               int64_t bytes, unsigned int generation)
+{
+    IO_CODE();
+    bdrv_bsc_insert(bs, offset, bytes, false, generation);
 }
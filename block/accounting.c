@@ -26,6 +26,7 @@
 #include "qemu/osdep.h"
 #include "block/accounting.h"
 #include "block/block_int.h"
+#include "qemu/host-utils.h"
 #include "qemu/timer.h"
 #include "sysemu/qtest.h"
 
@@ -296,3 +297,35 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+int64_t block_node_stats_start(BlockNodeStats *stats, enum BlockAcctType type)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qatomic_inc(&stats->op[type].in_flight);
+    return qemu_clock_get_ns(clock_type);
+}
+
+void block_node_stats_done(BlockNodeStats *stats, enum BlockAcctType type,
+                           int64_t start_time_ns, int64_t bytes, int ret)
+{
+    BlockNodeOpStats *s;
+    int64_t latency_ns = qemu_clock_get_ns(clock_type) - start_time_ns;
+    int bucket;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+    s = &stats->op[type];
+
+    /* Same layout as other log2 histograms: bucket 0 is for a latency of 0 */
+    bucket = MIN(64 - clz64(latency_ns), BLOCK_NODE_LATENCY_BUCKETS - 1);
+
+    stat64_add(&s->nr_ops, 1);
+    if (ret < 0) {
+        stat64_add(&s->failed_ops, 1);
+    } else {
+        stat64_add(&s->nr_bytes, bytes);
+    }
+    stat64_add(&s->total_time_ns, latency_ns);
+    stat64_add(&s->latency_log2[bucket], 1);
+    qatomic_dec(&s->in_flight);
+}
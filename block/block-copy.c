@@ -30,6 +30,8 @@
 #include "qemu/memalign.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
+#define BLOCK_COPY_MAX_COPY_RANGE_BATCH (1 * GiB)
+#define BLOCK_COPY_MAX_COPY_RANGE_FAILURES 8
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
 #define BLOCK_COPY_MAX_MEM (128 * MiB)
 #define BLOCK_COPY_MAX_WORKERS 64
@@ -137,6 +139,15 @@ typedef struct BlockCopyState {
     CoMutex lock;
     int64_t in_flight_bytes;
     BlockCopyMethod method;
+    /*
+     * Chunk size for COPY_RANGE_FULL.  Grows up to
+     * BLOCK_COPY_MAX_COPY_RANGE_BATCH while copy_range requests complete
+     * quickly (e.g. because they only clone extents), see
+     * block_copy_task_entry().
+     */
+    int64_t copy_range_size;
+    /* Number of consecutive requests for which copy_range failed */
+    int copy_range_failures;
     bool discard_source;
     BlockReqList reqs;
     QLIST_HEAD(, BlockCopyCallState) calls;
@@ -173,7 +184,7 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
         return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER),
                    s->max_transfer);
     case COPY_RANGE_FULL:
-        return MIN(MAX(s->cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
+        return MIN(MAX(s->cluster_size, s->copy_range_size),
                    s->max_transfer);
     default:
         /* Cannot have COPY_WRITE_ZEROES here.  */
@@ -181,6 +192,21 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/*
+ * Memory accounted for @task in s->mem.  copy_range needs no buffer unless
+ * it fails, in which case the data is copied in pieces of at most
+ * BLOCK_COPY_MAX_BUFFER (see block_copy_do_read_write()); still account the
+ * size that was used before batching so that the number of concurrent
+ * copy_range requests stays bounded.
+ */
+static int64_t block_copy_task_mem(BlockCopyTask *task)
+{
+    if (task->method == COPY_RANGE_SMALL || task->method == COPY_RANGE_FULL) {
+        return MIN(task->req.bytes, BLOCK_COPY_MAX_COPY_RANGE);
+    }
+    return task->req.bytes;
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -307,6 +333,8 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
          */
         s->method = use_copy_range ? COPY_RANGE_SMALL : COPY_READ_WRITE;
     }
+    s->copy_range_size = BLOCK_COPY_MAX_COPY_RANGE;
+    s->copy_range_failures = 0;
 }
 
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
@@ -415,6 +443,7 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
         .len = bdrv_dirty_bitmap_size(copy_bitmap),
         .write_flags = (is_fleecing ? BDRV_REQ_SERIALISING : 0),
         .mem = shres_create(BLOCK_COPY_MAX_MEM),
+        .copy_range_size = BLOCK_COPY_MAX_COPY_RANGE,
         .max_transfer = QEMU_ALIGN_DOWN(
                                     block_copy_max_transfer(source, target),
                                     cluster_size),
@@ -458,7 +487,7 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
 
     aio_task_pool_wait_slot(pool);
     if (aio_task_pool_status(pool) < 0) {
-        co_put_to_shres(task->s->mem, task->req.bytes);
+        co_put_to_shres(task->s->mem, block_copy_task_mem(task));
         block_copy_task_end(task, -ECANCELED);
         g_free(task);
         return -ECANCELED;
@@ -469,6 +498,46 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+/*
+ * Copy @nbytes at @offset through a bounce buffer.  Normally the request is
+ * small enough to be done at once, but after a failed copy_range it can be
+ * much larger, so use pieces of at most BLOCK_COPY_MAX_BUFFER (or one
+ * cluster).
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_do_read_write(BlockCopyState *s, int64_t offset, int64_t nbytes,
+                         bool *error_is_read)
+{
+    int64_t buf_size = MIN(nbytes, MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER));
+    void *bounce_buffer = qemu_blockalign(s->source->bs, buf_size);
+    int ret = 0;
+
+    while (nbytes) {
+        int64_t chunk = MIN(nbytes, buf_size);
+
+        ret = bdrv_co_pread(s->source, offset, chunk, bounce_buffer, 0);
+        if (ret < 0) {
+            trace_block_copy_read_fail(s, offset, ret);
+            *error_is_read = true;
+            break;
+        }
+
+        ret = bdrv_co_pwrite(s->target, offset, chunk, bounce_buffer,
+                             s->write_flags);
+        if (ret < 0) {
+            trace_block_copy_write_fail(s, offset, ret);
+            *error_is_read = false;
+            break;
+        }
+
+        offset += chunk;
+        nbytes -= chunk;
+    }
+
+    qemu_vfree(bounce_buffer);
+    return ret;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -479,7 +548,10 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
  *
  * @method is an in-out argument, so that copy_range can be either extended to
  * a full-size buffer or disabled if the copy_range attempt fails.  The output
- * value of @method should be used for subsequent tasks.
+ * value of @method should be used for subsequent tasks: COPY_RANGE_FULL after
+ * a successful copy_range, COPY_RANGE_SMALL if copy_range failed for this
+ * request only (the data has been copied with read+write instead) and
+ * COPY_READ_WRITE if copy_range is not supported at all.
  * Returns 0 on success.
  */
 static int coroutine_fn GRAPH_RDLOCK
@@ -488,7 +560,6 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
 {
     int ret;
     int64_t nbytes = MIN(offset + bytes, s->len) - offset;
-    void *bounce_buffer = NULL;
 
     assert(offset >= 0 && bytes > 0 && INT64_MAX - offset >= bytes);
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
@@ -519,47 +590,30 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
         }
 
         trace_block_copy_copy_range_fail(s, offset, ret);
-        *method = COPY_READ_WRITE;
+        switch (ret) {
+        case -ENOTSUP:
+        case -EXDEV:
+        case -EINVAL:
+            /* copy_range is not supported for these nodes */
+            *method = COPY_READ_WRITE;
+            break;
+        default:
+            /*
+             * May be a problem with this range only (e.g. a short copy at
+             * the end of the source), retry copy_range for the next request
+             */
+            *method = COPY_RANGE_SMALL;
+            break;
+        }
         /* Fall through to read+write with allocated buffer */
 
     case COPY_READ_WRITE_CLUSTER:
     case COPY_READ_WRITE:
-        /*
-         * In case of failed copy_range request above, we may proceed with
-         * buffered request larger than BLOCK_COPY_MAX_BUFFER.
-         * Still, further requests will be properly limited, so don't care too
-         * much. Moreover the most likely case (copy_range is unsupported for
-         * the configuration, so the very first copy_range request fails)
-         * is handled by setting large copy_size only after first successful
-         * copy_range.
-         */
-
-        bounce_buffer = qemu_blockalign(s->source->bs, nbytes);
-
-        ret = bdrv_co_pread(s->source, offset, nbytes, bounce_buffer, 0);
-        if (ret < 0) {
-            trace_block_copy_read_fail(s, offset, ret);
-            *error_is_read = true;
-            goto out;
-        }
-
-        ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
-                             s->write_flags);
-        if (ret < 0) {
-            trace_block_copy_write_fail(s, offset, ret);
-            *error_is_read = false;
-            goto out;
-        }
-
-    out:
-        qemu_vfree(bounce_buffer);
-        break;
+        return block_copy_do_read_write(s, offset, nbytes, error_is_read);
 
     default:
         abort();
     }
-
-    return ret;
 }
 
 static coroutine_fn int block_copy_task_entry(AioTask *task)
@@ -568,14 +622,43 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    bool copy_range = method == COPY_RANGE_SMALL || method == COPY_RANGE_FULL;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed_ns;
     int ret;
 
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
     }
+    elapsed_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
+        if (copy_range && method == COPY_RANGE_FULL) {
+            s->copy_range_failures = 0;
+            /*
+             * Batch more clusters into one request if copy_range is much
+             * faster than copying the data (e.g. it clones extents), but
+             * keep single requests short enough not to stall intersecting
+             * guest writes for too long.
+             */
+            if (elapsed_ns > BLOCK_COPY_SLICE_TIME) {
+                s->copy_range_size = MAX(s->copy_range_size / 2,
+                                         BLOCK_COPY_MAX_COPY_RANGE);
+            } else if (elapsed_ns < BLOCK_COPY_SLICE_TIME / 10 &&
+                       t->req.bytes >= s->copy_range_size) {
+                s->copy_range_size = MIN(s->copy_range_size * 2,
+                                         BLOCK_COPY_MAX_COPY_RANGE_BATCH);
+            }
+        } else if (copy_range && method == COPY_RANGE_SMALL) {
+            s->copy_range_size = BLOCK_COPY_MAX_COPY_RANGE;
+            if (++s->copy_range_failures >=
+                BLOCK_COPY_MAX_COPY_RANGE_FAILURES) {
+                /* Don't pay for a failing copy_range on every request */
+                method = COPY_READ_WRITE;
+            }
+        }
+
         if (s->method == t->method) {
             s->method = method;
         }
@@ -589,7 +672,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             progress_work_done(s->progress, t->req.bytes);
         }
     }
-    co_put_to_shres(s->mem, t->req.bytes);
+    co_put_to_shres(s->mem, block_copy_task_mem(t));
     block_copy_task_end(t, ret);
 
     if (s->discard_source && ret == 0) {
@@ -800,7 +883,7 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
 
         trace_block_copy_process(s, task->req.offset);
 
-        co_get_from_shres(s->mem, task->req.bytes);
+        co_get_from_shres(s->mem, block_copy_task_mem(task));
 
         offset = task_end(task);
         bytes = end - offset;
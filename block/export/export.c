@@ -60,6 +60,20 @@ BlockExport *blk_exp_find(const char *id)
     return NULL;
 }
 
+static void blk_exp_put_iothreads(IOThread **iothreads, AioContext **ctxs,
+                                  size_t num)
+{
+    size_t i;
+
+    for (i = 0; i < num; i++) {
+        if (iothreads[i]) {
+            object_unref(OBJECT(iothreads[i]));
+        }
+    }
+    g_free(iothreads);
+    g_free(ctxs);
+}
+
 static const BlockExportDriver *blk_exp_find_driver(BlockExportType type)
 {
     int i;
@@ -80,7 +94,12 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
     BlockDriverState *bs;
     BlockBackend *blk = NULL;
     AioContext *ctx;
+    IOThread **iothreads = NULL;
+    AioContext **iothread_ctxs = NULL;
+    size_t num_iothreads = 0;
+    strList *list;
     uint64_t perm;
+    size_t i;
     int ret;
 
     GLOBAL_STATE_CODE();
@@ -99,6 +118,11 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
         error_setg(errp, "No driver found for the requested export type");
         return NULL;
     }
+    if (export->iothreads && !drv->supports_iothreads) {
+        error_setg(errp, "Export type '%s' does not support iothreads",
+                   BlockExportType_str(export->type));
+        return NULL;
+    }
 
     bs = bdrv_lookup_bs(NULL, export->node_name, errp);
     if (!bs) {
@@ -138,6 +162,21 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
         }
     }
 
+    num_iothreads = QAPI_LIST_LENGTH(export->iothreads);
+    iothreads = g_new0(IOThread *, num_iothreads);
+    iothread_ctxs = g_new(AioContext *, num_iothreads);
+    for (i = 0, list = export->iothreads; list; i++, list = list->next) {
+        IOThread *iothread = iothread_by_id(list->value);
+
+        if (!iothread) {
+            error_setg(errp, "iothread \"%s\" not found", list->value);
+            goto fail;
+        }
+        iothreads[i] = iothread;
+        iothread_ctxs[i] = iothread_get_aio_context(iothread);
+        object_ref(OBJECT(iothread));
+    }
+
     /*
      * Block exports are used for non-shared storage migration. Make sure
      * that BDRV_O_INACTIVE is cleared and the image is ready for write
@@ -178,6 +217,10 @@ BlockExport *blk_exp_add(BlockExportOptions *export, Error **errp)
         .id         = g_strdup(export->id),
         .ctx        = ctx,
         .blk        = blk,
+
+        .iothread_ctxs      = iothread_ctxs,
+        .num_iothread_ctxs  = num_iothreads,
+        .iothreads          = iothreads,
     };
 
     ret = drv->create(exp, export, errp);
@@ -195,6 +238,7 @@ fail:
         blk_set_dev_ops(blk, NULL, NULL);
         blk_unref(blk);
     }
+    blk_exp_put_iothreads(iothreads, iothread_ctxs, num_iothreads);
     if (exp) {
         g_free(exp->id);
         g_free(exp);
@@ -219,6 +263,8 @@ static void blk_exp_delete_bh(void *opaque)
     blk_set_dev_ops(exp->blk, NULL, NULL);
     blk_unref(exp->blk);
     qapi_event_send_block_export_deleted(exp->id);
+    blk_exp_put_iothreads(exp->iothreads, exp->iothread_ctxs,
+                          exp->num_iothread_ctxs);
     g_free(exp->id);
     g_free(exp);
 }
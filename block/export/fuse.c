@@ -27,6 +27,7 @@
 #include "block/qapi.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/coroutine.h"
 #include "qemu/main-loop.h"
 #include "sysemu/block-backend.h"
 
@@ -45,13 +46,32 @@
 #define FUSE_MAX_BOUNCE_BYTES (MIN(BDRV_REQUEST_MAX_BYTES, 64 * 1024 * 1024))
 
 
-typedef struct FuseExport {
+typedef struct FuseExport FuseExport;
+
+/*
+ * Reader of the FUSE session FD.  All queues read requests from the same
+ * FD, each in its own AioContext and into its own buffer.
+ */
+typedef struct FuseQueue {
+    FuseExport *exp;
+    /* From common.iothread_ctxs, or NULL to follow the export's AioContext */
+    AioContext *iothread_ctx;
+    AioContext *ctx;
+    struct fuse_buf fuse_buf;
+    bool fd_handler_set_up;
+} FuseQueue;
+
+struct FuseExport {
     BlockExport common;
 
     struct fuse_session *fuse_session;
-    struct fuse_buf fuse_buf;
+    FuseQueue *queues;
+    size_t num_queues;
     unsigned int in_flight; /* atomic */
-    bool mounted, fd_handler_set_up;
+    bool mounted;
+
+    /* Serializes all changes of the image length */
+    CoMutex grow_lock;
 
     char *mountpoint;
     bool writable;
@@ -62,7 +82,7 @@ typedef struct FuseExport {
     mode_t st_mode;
     uid_t st_uid;
     gid_t st_gid;
-} FuseExport;
+};
 
 static GHashTable *exports;
 static const struct fuse_lowlevel_ops fuse_ops;
@@ -79,27 +99,46 @@ static void read_from_fuse_export(void *opaque);
 static bool is_regular_file(const char *path, Error **errp);
 
 
+static void fuse_queue_attach(FuseQueue *q)
+{
+    FuseExport *exp = q->exp;
+
+    q->ctx = q->iothread_ctx ?: exp->common.ctx;
+    aio_set_fd_handler(q->ctx, fuse_session_fd(exp->fuse_session),
+                       read_from_fuse_export, NULL, NULL, NULL, q);
+    q->fd_handler_set_up = true;
+}
+
+static void fuse_queue_detach(FuseQueue *q)
+{
+    if (q->fd_handler_set_up) {
+        aio_set_fd_handler(q->ctx, fuse_session_fd(q->exp->fuse_session),
+                           NULL, NULL, NULL, NULL, NULL);
+        q->fd_handler_set_up = false;
+    }
+}
+
 static void fuse_export_drained_begin(void *opaque)
 {
     FuseExport *exp = opaque;
+    size_t i;
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       NULL, NULL, NULL, NULL, NULL);
-    exp->fd_handler_set_up = false;
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_detach(&exp->queues[i]);
+    }
 }
 
 static void fuse_export_drained_end(void *opaque)
 {
     FuseExport *exp = opaque;
+    size_t i;
 
     /* Refresh AioContext in case it changed */
     exp->common.ctx = blk_get_aio_context(exp->common.blk);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_attach(&exp->queues[i]);
+    }
 }
 
 static bool fuse_export_drained_poll(void *opaque)
@@ -121,10 +160,23 @@ static int fuse_export_create(BlockExport *blk_exp,
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
     BlockExportOptionsFuse *args = &blk_exp_args->u.fuse;
+    size_t i;
     int ret;
 
     assert(blk_exp_args->type == BLOCK_EXPORT_TYPE_FUSE);
 
+    qemu_co_mutex_init(&exp->grow_lock);
+
+    /* One queue per iothread, or a single one in the export's AioContext */
+    exp->num_queues = MAX(blk_exp->num_iothread_ctxs, 1);
+    exp->queues = g_new0(FuseQueue, exp->num_queues);
+    for (i = 0; i < exp->num_queues; i++) {
+        exp->queues[i].exp = exp;
+        if (blk_exp->num_iothread_ctxs) {
+            exp->queues[i].iothread_ctx = blk_exp->iothread_ctxs[i];
+        }
+    }
+
     /* For growable and writable exports, take the RESIZE permission */
     if (args->growable || blk_exp_args->writable) {
         uint64_t blk_perm, blk_shared_perm;
@@ -134,7 +186,7 @@ static int fuse_export_create(BlockExport *blk_exp,
         ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
                            blk_shared_perm, errp);
         if (ret < 0) {
-            return ret;
+            goto fail;
         }
     }
 
@@ -234,6 +286,7 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
     const char *fuse_argv[4];
     char *mount_opts;
     struct fuse_args fuse_args;
+    size_t i;
     int ret;
 
     /*
@@ -269,10 +322,20 @@ static int setup_fuse_export(FuseExport *exp, const char *mountpoint,
 
     g_hash_table_insert(exports, g_strdup(mountpoint), NULL);
 
-    aio_set_fd_handler(exp->common.ctx,
-                       fuse_session_fd(exp->fuse_session),
-                       read_from_fuse_export, NULL, NULL, NULL, exp);
-    exp->fd_handler_set_up = true;
+    /*
+     * With several queues, all of them are woken up when a request comes
+     * in, but only one gets it.  The others must not block in read().
+     */
+    if (!g_unix_set_fd_nonblocking(fuse_session_fd(exp->fuse_session), true,
+                                   NULL)) {
+        error_setg(errp, "Failed to make FUSE session non-blocking");
+        ret = -EIO;
+        goto fail;
+    }
+
+    for (i = 0; i < exp->num_queues; i++) {
+        fuse_queue_attach(&exp->queues[i]);
+    }
 
     return 0;
 
@@ -281,48 +344,73 @@ fail:
     return ret;
 }
 
+static void fuse_inc_in_flight(FuseExport *exp)
+{
+    blk_exp_ref(&exp->common);
+    qatomic_inc(&exp->in_flight);
+}
+
+static void fuse_dec_in_flight(FuseExport *exp)
+{
+    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
+        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+    }
+
+    blk_exp_unref(&exp->common);
+}
+
+/**
+ * Process the request in @q's buffer.  All the fuse_ops handlers run in
+ * this coroutine, in the AioContext of the queue, so they must only use
+ * the coroutine variants of the block layer functions.
+ *
+ * The buffer is reused for the next request as soon as the coroutine
+ * yields for the first time, so handlers must be done with the request
+ * data by then.
+ */
+static void coroutine_fn co_process_fuse_request(void *opaque)
+{
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
+
+    fuse_session_process_buf(exp->fuse_session, &q->fuse_buf);
+    fuse_dec_in_flight(exp);
+}
+
 /**
  * Callback to be invoked when the FUSE session FD can be read from.
  * (This is basically the FUSE event loop.)
  */
 static void read_from_fuse_export(void *opaque)
 {
-    FuseExport *exp = opaque;
+    FuseQueue *q = opaque;
+    FuseExport *exp = q->exp;
     int ret;
 
-    blk_exp_ref(&exp->common);
-
-    qatomic_inc(&exp->in_flight);
+    fuse_inc_in_flight(exp);
 
     do {
-        ret = fuse_session_receive_buf(exp->fuse_session, &exp->fuse_buf);
+        ret = fuse_session_receive_buf(exp->fuse_session, &q->fuse_buf);
     } while (ret == -EINTR);
     if (ret < 0) {
-        goto out;
-    }
-
-    fuse_session_process_buf(exp->fuse_session, &exp->fuse_buf);
-
-out:
-    if (qatomic_fetch_dec(&exp->in_flight) == 1) {
-        aio_wait_kick(); /* wake AIO_WAIT_WHILE() */
+        /* -EAGAIN if another queue got the request */
+        fuse_dec_in_flight(exp);
+        return;
     }
 
-    blk_exp_unref(&exp->common);
+    qemu_coroutine_enter(qemu_coroutine_create(co_process_fuse_request, q));
 }
 
 static void fuse_export_shutdown(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         fuse_session_exit(exp->fuse_session);
 
-        if (exp->fd_handler_set_up) {
-            aio_set_fd_handler(exp->common.ctx,
-                               fuse_session_fd(exp->fuse_session),
-                               NULL, NULL, NULL, NULL, NULL);
-            exp->fd_handler_set_up = false;
+        for (i = 0; i < exp->num_queues; i++) {
+            fuse_queue_detach(&exp->queues[i]);
         }
     }
 
@@ -338,6 +426,7 @@ static void fuse_export_shutdown(BlockExport *blk_exp)
 static void fuse_export_delete(BlockExport *blk_exp)
 {
     FuseExport *exp = container_of(blk_exp, FuseExport, common);
+    size_t i;
 
     if (exp->fuse_session) {
         if (exp->mounted) {
@@ -347,7 +436,10 @@ static void fuse_export_delete(BlockExport *blk_exp)
         fuse_session_destroy(exp->fuse_session);
     }
 
-    free(exp->fuse_buf.mem);
+    for (i = 0; i < exp->num_queues; i++) {
+        free(exp->queues[i].fuse_buf.mem);
+    }
+    g_free(exp->queues);
     g_free(exp->mountpoint);
 }
 
@@ -411,13 +503,16 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     time_t now = time(NULL);
     FuseExport *exp = fuse_req_userdata(req);
 
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
     }
 
-    allocated_blocks = bdrv_get_allocated_file_size(blk_bs(exp->common.blk));
+    WITH_GRAPH_RDLOCK_GUARD() {
+        allocated_blocks =
+            bdrv_co_get_allocated_file_size(blk_bs(exp->common.blk));
+    }
     if (allocated_blocks <= 0) {
         allocated_blocks = DIV_ROUND_UP(length, 512);
     } else {
@@ -441,48 +536,26 @@ static void fuse_getattr(fuse_req_t req, fuse_ino_t inode,
     fuse_reply_attr(req, &statbuf, 1.);
 }
 
-static int fuse_do_truncate(const FuseExport *exp, int64_t size,
-                            bool req_zero_write, PreallocMode prealloc)
+/* Called with exp->grow_lock held */
+static int coroutine_fn fuse_co_do_truncate(const FuseExport *exp, int64_t size,
+                                            bool req_zero_write,
+                                            PreallocMode prealloc)
 {
-    uint64_t blk_perm, blk_shared_perm;
     BdrvRequestFlags truncate_flags = 0;
-    bool add_resize_perm;
-    int ret, ret_check;
 
-    /* Growable and writable exports have a permanent RESIZE permission */
-    add_resize_perm = !exp->growable && !exp->writable;
+    /*
+     * Only writable exports are ever resized, and those have a permanent
+     * RESIZE permission, so there is no need to change permissions here
+     * (which could not be done in a coroutine or an iothread anyway).
+     */
+    assert(exp->writable);
 
     if (req_zero_write) {
         truncate_flags |= BDRV_REQ_ZERO_WRITE;
     }
 
-    if (add_resize_perm) {
-
-        if (!qemu_in_main_thread()) {
-            /* Changing permissions like below only works in the main thread */
-            return -EPERM;
-        }
-
-        blk_get_perm(exp->common.blk, &blk_perm, &blk_shared_perm);
-
-        ret = blk_set_perm(exp->common.blk, blk_perm | BLK_PERM_RESIZE,
-                           blk_shared_perm, NULL);
-        if (ret < 0) {
-            return ret;
-        }
-    }
-
-    ret = blk_truncate(exp->common.blk, size, true, prealloc,
-                       truncate_flags, NULL);
-
-    if (add_resize_perm) {
-        /* Must succeed, because we are only giving up the RESIZE permission */
-        ret_check = blk_set_perm(exp->common.blk, blk_perm,
-                                 blk_shared_perm, &error_abort);
-        assert(ret_check == 0);
-    }
-
-    return ret;
+    return blk_co_truncate(exp->common.blk, size, true, prealloc,
+                           truncate_flags, NULL);
 }
 
 /**
@@ -538,7 +611,11 @@ static void fuse_setattr(fuse_req_t req, fuse_ino_t inode, struct stat *statbuf,
             return;
         }
 
-        ret = fuse_do_truncate(exp, statbuf->st_size, true, PREALLOC_MODE_OFF);
+        /* Do not race with writes that grow the image */
+        qemu_co_mutex_lock(&exp->grow_lock);
+        ret = fuse_co_do_truncate(exp, statbuf->st_size, true,
+                                  PREALLOC_MODE_OFF);
+        qemu_co_mutex_unlock(&exp->grow_lock);
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -591,7 +668,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
      * Clients will expect short reads at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
         fuse_reply_err(req, -length);
         return;
@@ -607,7 +684,7 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
         return;
     }
 
-    ret = blk_pread(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pread(exp->common.blk, offset, size, buf, 0);
     if (ret >= 0) {
         fuse_reply_buf(req, buf, size);
     } else {
@@ -618,13 +695,16 @@ static void fuse_read(fuse_req_t req, fuse_ino_t inode,
 }
 
 /**
- * Handle client writes to the exported image.
+ * Handle client writes to the exported image.  @buf belongs to the queue
+ * that received the request and is reused for the next one, so the data
+ * is copied before anything can yield.
  */
 static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
                        size_t size, off_t offset, struct fuse_file_info *fi)
 {
     FuseExport *exp = fuse_req_userdata(req);
     int64_t length;
+    void *copy;
     int ret;
 
     /* Limited by max_write, should not happen */
@@ -638,56 +718,67 @@ static void fuse_write(fuse_req_t req, fuse_ino_t inode, const char *buf,
         return;
     }
 
+    copy = qemu_try_blockalign(blk_bs(exp->common.blk), size);
+    if (!copy) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    memcpy(copy, buf, size);
+
     /**
      * Clients will expect short writes at EOF, so we have to limit
      * offset+size to the image length.
      */
-    length = blk_getlength(exp->common.blk);
+    length = blk_co_getlength(exp->common.blk);
     if (length < 0) {
-        fuse_reply_err(req, -length);
-        return;
+        ret = length;
+        goto out;
     }
 
     if (offset + size > length) {
         if (exp->growable) {
-            ret = fuse_do_truncate(exp, offset + size, true, PREALLOC_MODE_OFF);
+            /*
+             * Concurrent writes beyond EOF must not shrink the image again,
+             * so check the length again under the lock.
+             */
+            qemu_co_mutex_lock(&exp->grow_lock);
+            length = blk_co_getlength(exp->common.blk);
+            ret = length < 0 ? length : 0;
+            if (ret == 0 && offset + size > length) {
+                ret = fuse_co_do_truncate(exp, offset + size, true,
+                                          PREALLOC_MODE_OFF);
+            }
+            qemu_co_mutex_unlock(&exp->grow_lock);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                goto out;
             }
         } else {
             size = length - offset;
         }
     }
 
-    ret = blk_pwrite(exp->common.blk, offset, size, buf, 0);
+    ret = blk_co_pwrite(exp->common.blk, offset, size, copy, 0);
+
+out:
     if (ret >= 0) {
         fuse_reply_write(req, size);
     } else {
         fuse_reply_err(req, -ret);
     }
+
+    qemu_vfree(copy);
 }
 
-/**
- * Let clients perform various fallocate() operations.
- */
-static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
-                           off_t offset, off_t length,
-                           struct fuse_file_info *fi)
+/* Called with exp->grow_lock held */
+static int coroutine_fn fuse_co_do_fallocate(FuseExport *exp, int mode,
+                                             off_t offset, off_t length)
 {
-    FuseExport *exp = fuse_req_userdata(req);
     int64_t blk_len;
     int ret;
 
-    if (!exp->writable) {
-        fuse_reply_err(req, EACCES);
-        return;
-    }
-
-    blk_len = blk_getlength(exp->common.blk);
+    blk_len = blk_co_getlength(exp->common.blk);
     if (blk_len < 0) {
-        fuse_reply_err(req, -blk_len);
-        return;
+        return blk_len;
     }
 
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
@@ -699,34 +790,32 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     if (!mode) {
         /* We can only fallocate at the EOF with a truncate */
         if (offset < blk_len) {
-            fuse_reply_err(req, EOPNOTSUPP);
-            return;
+            return -EOPNOTSUPP;
         }
 
         if (offset > blk_len) {
             /* No preallocation needed here */
-            ret = fuse_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset, true, PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
-        ret = fuse_do_truncate(exp, offset + length, true,
-                               PREALLOC_MODE_FALLOC);
+        ret = fuse_co_do_truncate(exp, offset + length, true,
+                                  PREALLOC_MODE_FALLOC);
     }
 #ifdef CONFIG_FALLOCATE_PUNCH_HOLE
     else if (mode & FALLOC_FL_PUNCH_HOLE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE)) {
-            fuse_reply_err(req, EINVAL);
-            return;
+            return -EINVAL;
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk, offset, size,
-                                    BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK);
+            ret = blk_co_pwrite_zeroes(exp->common.blk, offset, size,
+                                       BDRV_REQ_MAY_UNMAP |
+                                       BDRV_REQ_NO_FALLBACK);
             if (ret == -ENOTSUP) {
                 /*
                  * fallocate() specifies to return EOPNOTSUPP for unsupported
@@ -744,19 +833,18 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
     else if (mode & FALLOC_FL_ZERO_RANGE) {
         if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + length > blk_len) {
             /* No need for zeroes, we are going to write them ourselves */
-            ret = fuse_do_truncate(exp, offset + length, false,
-                                   PREALLOC_MODE_OFF);
+            ret = fuse_co_do_truncate(exp, offset + length, false,
+                                      PREALLOC_MODE_OFF);
             if (ret < 0) {
-                fuse_reply_err(req, -ret);
-                return;
+                return ret;
             }
         }
 
         do {
             int size = MIN(length, BDRV_REQUEST_MAX_BYTES);
 
-            ret = blk_pwrite_zeroes(exp->common.blk,
-                                    offset, size, 0);
+            ret = blk_co_pwrite_zeroes(exp->common.blk,
+                                       offset, size, 0);
             offset += size;
             length -= size;
         } while (ret == 0 && length > 0);
@@ -766,6 +854,29 @@ static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
         ret = -EOPNOTSUPP;
     }
 
+    return ret;
+}
+
+/**
+ * Let clients perform various fallocate() operations.
+ */
+static void fuse_fallocate(fuse_req_t req, fuse_ino_t inode, int mode,
+                           off_t offset, off_t length,
+                           struct fuse_file_info *fi)
+{
+    FuseExport *exp = fuse_req_userdata(req);
+    int ret;
+
+    if (!exp->writable) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    /* Do not race with writes that grow the image */
+    qemu_co_mutex_lock(&exp->grow_lock);
+    ret = fuse_co_do_fallocate(exp, mode, offset, length);
+    qemu_co_mutex_unlock(&exp->grow_lock);
+
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
@@ -778,7 +889,7 @@ static void fuse_fsync(fuse_req_t req, fuse_ino_t inode, int datasync,
     FuseExport *exp = fuse_req_userdata(req);
     int ret;
 
-    ret = blk_flush(exp->common.blk);
+    ret = blk_co_flush(exp->common.blk);
     fuse_reply_err(req, ret < 0 ? -ret : 0);
 }
 
@@ -810,8 +921,11 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
         int64_t pnum;
         int ret;
 
-        ret = bdrv_block_status_above(blk_bs(exp->common.blk), NULL,
-                                      offset, INT64_MAX, &pnum, NULL, NULL);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_block_status_above(blk_bs(exp->common.blk), NULL,
+                                             offset, INT64_MAX, &pnum, NULL,
+                                             NULL);
+        }
         if (ret < 0) {
             fuse_reply_err(req, -ret);
             return;
@@ -829,7 +943,7 @@ static void fuse_lseek(fuse_req_t req, fuse_ino_t inode, off_t offset,
              * and @blk_len (the client-visible EOF).
              */
 
-            blk_len = blk_getlength(exp->common.blk);
+            blk_len = blk_co_getlength(exp->common.blk);
             if (blk_len < 0) {
                 fuse_reply_err(req, -blk_len);
                 return;
@@ -885,6 +999,7 @@ static const struct fuse_lowlevel_ops fuse_ops = {
 const BlockExportDriver blk_exp_fuse = {
     .type               = BLOCK_EXPORT_TYPE_FUSE,
     .instance_size      = sizeof(FuseExport),
+    .supports_iothreads = true,
     .create             = fuse_export_create,
     .delete             = fuse_export_delete,
     .request_shutdown   = fuse_export_shutdown,
@@ -16,6 +16,7 @@
 #include "qapi/error.h"
 #include "block/export.h"
 #include "qemu/error-report.h"
+#include "qemu/defer-call.h"
 #include "util/block-helpers.h"
 #include "subprojects/libvduse/libvduse.h"
 #include "virtio-blk-handler.h"
@@ -59,10 +60,18 @@ static void vduse_blk_inflight_dec(VduseBlkExport *vblk_exp)
     }
 }
 
+/* Batch notifications while inside a defer_call_begin()/defer_call_end() */
+static void vduse_blk_notify_deferred_fn(void *opaque)
+{
+    VduseVirtq *vq = opaque;
+
+    vduse_queue_notify(vq);
+}
+
 static void vduse_blk_req_complete(VduseBlkReq *req, size_t in_len)
 {
     vduse_queue_push(req->vq, &req->elem, in_len);
-    vduse_queue_notify(req->vq);
+    defer_call(vduse_blk_notify_deferred_fn, req->vq);
 
     free(req);
 }
@@ -96,6 +105,8 @@ static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
 
+    defer_call_begin();
+
     while (1) {
         VduseBlkReq *req;
 
@@ -111,6 +122,39 @@ static void vduse_blk_vq_handler(VduseDev *dev, VduseVirtq *vq)
         vduse_blk_inflight_inc(vblk_exp);
         qemu_coroutine_enter(co);
     }
+
+    defer_call_end();
+}
+
+/* Returns the AioContext in which @vq is processed */
+static AioContext *vduse_blk_queue_ctx(VduseBlkExport *vblk_exp,
+                                       VduseVirtq *vq)
+{
+    BlockExport *exp = &vblk_exp->export;
+    uint16_t i;
+
+    if (!exp->num_iothread_ctxs) {
+        return exp->ctx;
+    }
+
+    /* Virtqueues are assigned round-robin to the iothreads */
+    for (i = 0; vduse_dev_get_queue(vblk_exp->dev, i) != vq; i++) {
+        assert(i < vblk_exp->num_queues);
+    }
+    return exp->iothread_ctxs[i % exp->num_iothread_ctxs];
+}
+
+/*
+ * Returns the AioContext in which the VDUSE device fd is handled.  With
+ * iothreads, this is the main loop, so that vduse_blk_disable_queue() can
+ * wait for the iothreads.
+ */
+static AioContext *vduse_blk_dev_ctx(VduseBlkExport *vblk_exp)
+{
+    if (vblk_exp->export.num_iothread_ctxs) {
+        return qemu_get_aio_context();
+    }
+    return vblk_exp->export.ctx;
 }
 
 static void on_vduse_vq_kick(void *opaque)
@@ -136,23 +180,41 @@ static void vduse_blk_enable_queue(VduseDev *dev, VduseVirtq *vq)
         return; /* vduse_blk_drained_end() will start vqs later */
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, vduse_queue_get_fd(vq),
+    aio_set_fd_handler(vduse_blk_queue_ctx(vblk_exp, vq),
+                       vduse_queue_get_fd(vq),
                        on_vduse_vq_kick, NULL, NULL, NULL, vq);
     /* Make sure we don't miss any kick after reconnecting */
     eventfd_write(vduse_queue_get_fd(vq), 1);
 }
 
+/* Context: BH in the AioContext of the virtqueue */
+static void vduse_blk_disable_queue_bh(void *opaque)
+{
+    VduseVirtq *vq = opaque;
+
+    aio_set_fd_handler(qemu_get_current_aio_context(), vduse_queue_get_fd(vq),
+                       NULL, NULL, NULL, NULL, NULL);
+}
+
 static void vduse_blk_disable_queue(VduseDev *dev, VduseVirtq *vq)
 {
     VduseBlkExport *vblk_exp = vduse_dev_get_priv(dev);
+    AioContext *ctx = vduse_blk_queue_ctx(vblk_exp, vq);
     int fd = vduse_queue_get_fd(vq);
 
     if (fd < 0) {
         return;
     }
 
-    aio_set_fd_handler(vblk_exp->export.ctx, fd,
-                       NULL, NULL, NULL, NULL, NULL);
+    /*
+     * libvduse may reset or free the virtqueue next, so on_vduse_vq_kick()
+     * must not be running in its iothread anymore when we return.
+     */
+    if (ctx == qemu_get_current_aio_context()) {
+        vduse_blk_disable_queue_bh(vq);
+    } else {
+        aio_wait_bh_oneshot(ctx, vduse_blk_disable_queue_bh, vq);
+    }
 }
 
 static const VduseOps vduse_blk_ops = {
@@ -169,6 +231,10 @@ static void on_vduse_dev_kick(void *opaque)
 
 static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
 {
+    if (vblk_exp->export.num_iothread_ctxs) {
+        return; /* The device fd stays in the main loop */
+    }
+
     aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
                        on_vduse_dev_kick, NULL, NULL, NULL,
                        vblk_exp->dev);
@@ -178,6 +244,10 @@ static void vduse_blk_attach_ctx(VduseBlkExport *vblk_exp, AioContext *ctx)
 
 static void vduse_blk_detach_ctx(VduseBlkExport *vblk_exp)
 {
+    if (vblk_exp->export.num_iothread_ctxs) {
+        return; /* The device fd stays in the main loop */
+    }
+
     aio_set_fd_handler(vblk_exp->export.ctx, vduse_dev_get_fd(vblk_exp->dev),
                        NULL, NULL, NULL, NULL, NULL);
 
@@ -214,11 +284,21 @@ static void vduse_blk_resize(void *opaque)
                             (char *)&config.capacity);
 }
 
+/*
+ * Drained sections must not poll, so unlike vduse_blk_disable_queue(), don't
+ * wait for the iothreads here.  Requests that a running kick handler still
+ * submits are covered by the in-flight counter.
+ */
 static void vduse_blk_stop_virtqueues(VduseBlkExport *vblk_exp)
 {
     for (uint16_t i = 0; i < vblk_exp->num_queues; i++) {
         VduseVirtq *vq = vduse_dev_get_queue(vblk_exp->dev, i);
-        vduse_blk_disable_queue(vblk_exp->dev, vq);
+        int fd = vduse_queue_get_fd(vq);
+
+        if (fd >= 0) {
+            aio_set_fd_handler(vduse_blk_queue_ctx(vblk_exp, vq), fd,
+                               NULL, NULL, NULL, NULL, NULL);
+        }
     }
 
     vblk_exp->vqs_started = false;
@@ -304,6 +384,7 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
             return -EINVAL;
         }
     }
+
     vblk_exp->num_queues = num_queues;
     vblk_exp->handler.blk = exp->blk;
     vblk_exp->handler.serial = g_strdup(vblk_opts->serial ?: "");
@@ -364,7 +445,8 @@ static int vduse_blk_exp_create(BlockExport *exp, BlockExportOptions *opts,
         vduse_dev_setup_queue(vblk_exp->dev, i, queue_size);
     }
 
-    aio_set_fd_handler(exp->ctx, vduse_dev_get_fd(vblk_exp->dev),
+    aio_set_fd_handler(vduse_blk_dev_ctx(vblk_exp),
+                       vduse_dev_get_fd(vblk_exp->dev),
                        on_vduse_dev_kick, NULL, NULL, NULL, vblk_exp->dev);
 
     blk_add_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
@@ -394,7 +476,9 @@ static void vduse_blk_exp_delete(BlockExport *exp)
 
     assert(qatomic_read(&vblk_exp->inflight) == 0);
 
-    vduse_blk_detach_ctx(vblk_exp);
+    aio_set_fd_handler(vduse_blk_dev_ctx(vblk_exp),
+                       vduse_dev_get_fd(vblk_exp->dev),
+                       NULL, NULL, NULL, NULL, NULL);
     blk_remove_aio_context_notifier(exp->blk, blk_aio_attached, blk_aio_detach,
                                     vblk_exp);
     ret = vduse_dev_destroy(vblk_exp->dev);
@@ -416,6 +500,7 @@ static void vduse_blk_exp_request_shutdown(BlockExport *exp)
 const BlockExportDriver blk_exp_vduse_blk = {
     .type               = BLOCK_EXPORT_TYPE_VDUSE_BLK,
     .instance_size      = sizeof(VduseBlkExport),
+    .supports_iothreads = true,
     .create             = vduse_blk_exp_create,
     .delete             = vduse_blk_exp_delete,
     .request_shutdown   = vduse_blk_exp_request_shutdown,
@@ -161,8 +161,22 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * io_uring instance of the home AioContext that s->fd is registered
+     * with as a fixed file, and its index there
+     */
+    LuringState *luring;
+    int luring_fixed_file;
+    bool luring_fixed_file_failed;
+#endif
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
+    /*
+     * FICLONERANGE may work for copy_range requests with this as target.
+     * Accessed atomically from thread pool workers.
+     */
+    bool has_clone_range;
     bool needs_alignment;
     bool force_alignment;
     bool drop_cache;
@@ -757,6 +771,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
             goto fail;
         } else {
             s->has_fallocate = true;
+            s->has_clone_range = true;
         }
     } else {
         if (!(S_ISCHR(st.st_mode) || S_ISBLK(st.st_mode))) {
@@ -2157,6 +2172,56 @@ static int handle_aiocb_zone_mgmt(void *opaque)
 }
 #endif
 
+#ifdef FICLONERANGE
+/*
+ * Try to share the source extents with the target instead of copying the
+ * data.  Returns true on success, false if the range must be copied.
+ */
+static bool raw_clone_range(RawPosixAIOData *aiocb)
+{
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range fcr = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!qatomic_read(&s->has_clone_range)) {
+        return false;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &fcr);
+    } while (ret < 0 && errno == EINTR);
+    trace_file_clone_range(aiocb->bs, aiocb->aio_fildes, aiocb->aio_offset,
+                           aiocb->copy_range.aio_fd2,
+                           aiocb->copy_range.aio_offset2, aiocb->aio_nbytes,
+                           ret < 0 ? -errno : 0);
+    if (ret == 0) {
+        return true;
+    }
+
+    switch (errno) {
+    case EOPNOTSUPP:
+    case ENOTTY:
+    case EXDEV:
+    case EPERM:
+        /* Not supported by the file system or for this pair of files */
+        qatomic_set(&s->has_clone_range, false);
+        break;
+    default:
+        /*
+         * Probably a range that is not aligned to the file system block
+         * size, the next one may succeed
+         */
+        break;
+    }
+    return false;
+}
+#endif
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2164,6 +2229,12 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+#ifdef FICLONERANGE
+    if (raw_clone_range(aiocb)) {
+        return 0;
+    }
+#endif
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2453,6 +2524,65 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
     return true;
 }
+
+/*
+ * Returns the index of s->fd in the registered file table of the current
+ * thread's io_uring instance, or -1 if requests must use s->fd directly.
+ * s->fd is only registered with the io_uring instance of the node's home
+ * AioContext, which raw_detach_aio_context() takes care of.
+ */
+static int raw_luring_fixed_file(BlockDriverState *bs)
+{
+    BDRVRawState *s = bs->opaque;
+    AioContext *ctx = qemu_get_current_aio_context();
+    LuringState *ring;
+    int index;
+
+    if (ctx != bdrv_get_aio_context(bs)) {
+        return -1;
+    }
+
+    ring = aio_get_linux_io_uring(ctx);
+    if (s->luring == ring) {
+        return s->luring_fixed_file;
+    } else if (s->luring || s->luring_fixed_file_failed) {
+        return -1;
+    }
+
+    index = luring_register_file(ring, s->fd);
+    if (index < 0) {
+        /* Don't try again for every request */
+        s->luring_fixed_file_failed = true;
+        return -1;
+    }
+
+    s->luring = ring;
+    s->luring_fixed_file = index;
+    return index;
+}
+
+/* Must be called before s->fd is closed or replaced */
+static void raw_luring_unregister_file(BDRVRawState *s)
+{
+    if (s->luring) {
+        luring_unregister_file(s->luring, s->luring_fixed_file);
+        s->luring = NULL;
+    }
+    s->luring_fixed_file_failed = false;
+}
+
+static int coroutine_fn raw_luring_co_submit(BlockDriverState *bs,
+                                             uint64_t offset,
+                                             QEMUIOVector *qiov, int type)
+{
+    BDRVRawState *s = bs->opaque;
+    int index = raw_luring_fixed_file(bs);
+
+    if (index >= 0) {
+        return luring_co_submit_fixed(bs, index, offset, qiov, type);
+    }
+    return luring_co_submit(bs, s->fd, offset, qiov, type);
+}
 #endif
 
 #ifdef CONFIG_LINUX_AIO
@@ -2508,7 +2638,7 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = raw_luring_co_submit(bs, offset, qiov, type);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2600,7 +2730,7 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return raw_luring_co_submit(bs, 0, NULL, QEMU_AIO_FLUSH);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2611,6 +2741,13 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     return raw_thread_pool_submit(handle_aiocb_flush, &acb);
 }
 
+static void raw_detach_aio_context(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    raw_luring_unregister_file(bs->opaque);
+#endif
+}
+
 static void raw_close(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
@@ -2618,6 +2755,9 @@ static void raw_close(BlockDriverState *bs)
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        raw_luring_unregister_file(s);
 #endif
         qemu_close(s->fd);
         s->fd = -1;
@@ -3809,6 +3949,9 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        raw_luring_unregister_file(s);
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
@@ -3891,6 +4034,7 @@ BlockDriver bdrv_file = {
     .bdrv_reopen_commit = raw_reopen_commit,
     .bdrv_reopen_abort = raw_reopen_abort,
     .bdrv_close = raw_close,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
     .bdrv_co_create = raw_co_create,
     .bdrv_co_create_opts = raw_co_create_opts,
     .bdrv_has_zero_init = bdrv_has_zero_init_1,
@@ -4254,6 +4398,7 @@ static BlockDriver bdrv_host_device = {
     .bdrv_parse_filename = hdev_parse_filename,
     .bdrv_open          = hdev_open,
     .bdrv_close         = raw_close,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
     .bdrv_reopen_prepare = raw_reopen_prepare,
     .bdrv_reopen_commit  = raw_reopen_commit,
     .bdrv_reopen_abort   = raw_reopen_abort,
@@ -4393,6 +4538,7 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_parse_filename = cdrom_parse_filename,
     .bdrv_open          = cdrom_open,
     .bdrv_close         = raw_close,
+    .bdrv_detach_aio_context = raw_detach_aio_context,
     .bdrv_reopen_prepare = raw_reopen_prepare,
     .bdrv_reopen_commit  = raw_reopen_commit,
     .bdrv_reopen_abort   = raw_reopen_abort,
@@ -1039,6 +1039,19 @@ out:
     return ret;
 }
 
+/*
+ * Drop cached block-status regions that a write to @bs may have allocated.
+ * Only nodes that support backing files cache unallocated regions, and
+ * the data regions cached for protocol nodes stay valid.
+ */
+static void bdrv_bsc_invalidate_written(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes)
+{
+    if (bs->drv && bs->drv->supports_backing) {
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
+    }
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 bdrv_driver_pwritev(BlockDriverState *bs, int64_t offset, int64_t bytes,
                     QEMUIOVector *qiov, size_t qiov_offset,
@@ -1279,6 +1292,7 @@ bdrv_co_do_copy_on_readv(BdrvChild *child, int64_t offset, int64_t bytes,
                                           &local_qiov, 0,
                                           BDRV_REQ_WRITE_UNCHANGED);
             }
+            bdrv_bsc_invalidate_written(bs, align_offset, pnum);
 
             if (ret < 0) {
                 /* It might be okay to ignore write errors for guest
@@ -1456,6 +1470,7 @@ out:
 typedef struct BdrvRequestPadding {
     uint8_t *buf;
     size_t buf_len;
+    AioContext *buf_ctx; /* buf was taken from this AioContext's cache */
     uint8_t *tail_buf;
     size_t head;
     size_t tail;
@@ -1468,6 +1483,48 @@ typedef struct BdrvRequestPadding {
     QEMUIOVector pre_collapse_qiov;
 } BdrvRequestPadding;
 
+/*
+ * Padding buffers are allocated for every unaligned request, which can be
+ * most requests of some guests.  Small ones are kept in a cache in the
+ * current AioContext so that they can be reused without going through the
+ * allocator.
+ */
+static void bdrv_padding_alloc_buf(BlockDriverState *bs,
+                                   BdrvRequestPadding *pad)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    if (ctx && in_aio_context_home_thread(ctx) &&
+        pad->buf_len <= AIO_PADDING_BUF_SIZE &&
+        bdrv_opt_mem_align(bs) <= qemu_real_host_page_size())
+    {
+        pad->buf_ctx = ctx;
+        if (ctx->nr_padding_bufs) {
+            pad->buf = ctx->padding_bufs[--ctx->nr_padding_bufs];
+        } else {
+            pad->buf = qemu_memalign(qemu_real_host_page_size(),
+                                     AIO_PADDING_BUF_SIZE);
+        }
+        return;
+    }
+
+    pad->buf = qemu_blockalign(bs, pad->buf_len);
+}
+
+static void bdrv_padding_free_buf(BdrvRequestPadding *pad)
+{
+    AioContext *ctx = pad->buf_ctx;
+
+    if (ctx && in_aio_context_home_thread(ctx) &&
+        ctx->nr_padding_bufs < AIO_PADDING_BUFS_MAX)
+    {
+        ctx->padding_bufs[ctx->nr_padding_bufs++] = pad->buf;
+        return;
+    }
+
+    qemu_vfree(pad->buf);
+}
+
 static bool bdrv_init_padding(BlockDriverState *bs,
                               int64_t offset, int64_t bytes,
                               bool write,
@@ -1496,7 +1553,7 @@ static bool bdrv_init_padding(BlockDriverState *bs,
 
     sum = pad->head + bytes + pad->tail;
     pad->buf_len = (sum > align && pad->head && pad->tail) ? 2 * align : align;
-    pad->buf = qemu_blockalign(bs, pad->buf_len);
+    bdrv_padding_alloc_buf(bs, pad);
     pad->merge_reads = sum == pad->buf_len;
     if (pad->tail) {
         pad->tail_buf = pad->buf + pad->buf_len - align;
@@ -1586,7 +1643,7 @@ static void bdrv_padding_finalize(BdrvRequestPadding *pad)
         qemu_iovec_destroy(&pad->pre_collapse_qiov);
     }
     if (pad->buf) {
-        qemu_vfree(pad->buf);
+        bdrv_padding_free_buf(pad);
         qemu_iovec_destroy(&pad->local_qiov);
     }
     memset(pad, 0, sizeof(*pad));
@@ -1776,6 +1833,8 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    int64_t orig_bytes = bytes;
+    int64_t start_ns;
     int ret;
     IO_CODE();
 
@@ -1803,6 +1862,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    start_ns = block_node_stats_start(&bs->node_stats, BLOCK_ACCT_READ);
 
     /* Don't do copy-on-read if we read data before write operation */
     if (qatomic_read(&bs->copy_on_read)) {
@@ -1823,6 +1883,8 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     bdrv_padding_finalize(&pad);
 
 fail:
+    block_node_stats_done(&bs->node_stats, BLOCK_ACCT_READ, start_ns,
+                          orig_bytes, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -2037,6 +2099,12 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, int64_t bytes,
         bdrv_parent_cb_resize(bs);
         bdrv_dirty_bitmap_truncate(bs, end_sector << BDRV_SECTOR_BITS);
     }
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        bdrv_bsc_invalidate_written(bs, offset, INT64_MAX);
+    } else {
+        bdrv_bsc_invalidate_written(bs, offset, bytes);
+    }
+
     if (req->bytes) {
         switch (req->type) {
         case BDRV_TRACKED_WRITE:
@@ -2229,6 +2297,8 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    int64_t orig_bytes = bytes;
+    int64_t start_ns;
     int ret;
     bool padded = false;
     IO_CODE();
@@ -2281,6 +2351,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     }
 
     bdrv_inc_in_flight(bs);
+    start_ns = block_node_stats_start(&bs->node_stats, BLOCK_ACCT_WRITE);
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
 
     if (flags & BDRV_REQ_ZERO_WRITE) {
@@ -2308,6 +2379,8 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
 
 out:
     tracked_request_end(&req);
+    block_node_stats_done(&bs->node_stats, BLOCK_ACCT_WRITE, start_ns,
+                          orig_bytes, ret);
     bdrv_dec_in_flight(bs);
 
     return ret;
@@ -2454,7 +2527,7 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
          * This is especially problematic for images with large data areas,
          * because finding the few holes in them and giving them special
          * treatment does not gain much performance.  Therefore, we try to
-         * cache the last-identified data region.
+         * cache the identified data regions.
          *
          * Second, limiting ourselves to protocol nodes allows us to assume
          * the block status for data regions to be DATA | OFFSET_VALID, and
@@ -2464,6 +2537,12 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
          * the cached regions without the cache being invalidated, and so
          * we may report zeroes as data.  This is not catastrophic,
          * however, because reporting zeroes as data is fine.
+         *
+         * For nodes that support backing files, we also cache the
+         * regions that are not allocated, so that walking down a long
+         * backing chain does not need to query every layer again.  This
+         * is only safe because nobody but us can allocate in these nodes
+         * (see bdrv_bsc_invalidate_written()).
          */
         if (QLIST_EMPTY(&bs->children) &&
             bdrv_bsc_is_data(bs, aligned_offset, pnum))
@@ -2471,7 +2550,13 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
             ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
             local_file = bs;
             local_map = aligned_offset;
+        } else if (bs->drv->supports_backing &&
+                   bdrv_bsc_is_unallocated(bs, aligned_offset, pnum))
+        {
+            ret = 0;
         } else {
+            unsigned int bsc_gen = bdrv_bsc_generation(bs);
+
             ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
                                                 aligned_bytes, pnum, &local_map,
                                                 &local_file);
@@ -2505,6 +2590,8 @@ bdrv_co_do_block_status(BlockDriverState *bs, bool want_zero,
                 assert(local_file == bs);
                 assert(local_map == aligned_offset);
                 bdrv_bsc_fill(bs, aligned_offset, *pnum);
+            } else if (ret == 0 && bs->drv->supports_backing) {
+                bdrv_bsc_fill_unallocated(bs, aligned_offset, *pnum, bsc_gen);
             }
         }
     } else {
@@ -2949,11 +3036,13 @@ int coroutine_fn bdrv_co_flush(BlockDriverState *bs)
     BdrvChild *primary_child = bdrv_primary_child(bs);
     BdrvChild *child;
     int current_gen;
+    int64_t start_ns;
     int ret = 0;
     IO_CODE();
 
     assert_bdrv_graph_readable();
     bdrv_inc_in_flight(bs);
+    start_ns = block_node_stats_start(&bs->node_stats, BLOCK_ACCT_FLUSH);
 
     if (!bdrv_co_is_inserted(bs) || bdrv_is_read_only(bs) ||
         bdrv_is_sg(bs)) {
@@ -3065,6 +3154,7 @@ out:
     qemu_mutex_unlock(&bs->reqs_lock);
 
 early_exit:
+    block_node_stats_done(&bs->node_stats, BLOCK_ACCT_FLUSH, start_ns, 0, ret);
     bdrv_dec_in_flight(bs);
     return ret;
 }
@@ -3075,6 +3165,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
     BdrvTrackedRequest req;
     int ret;
     int64_t max_pdiscard;
+    int64_t start_ns;
     int head, tail, align;
     BlockDriverState *bs = child->bs;
     IO_CODE();
@@ -3116,6 +3207,7 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
     tail = (offset + bytes) % align;
 
     bdrv_inc_in_flight(bs);
+    start_ns = block_node_stats_start(&bs->node_stats, BLOCK_ACCT_UNMAP);
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_DISCARD);
 
     ret = bdrv_co_write_req_prepare(child, offset, bytes, &req, 0);
@@ -3186,6 +3278,8 @@ int coroutine_fn bdrv_co_pdiscard(BdrvChild *child, int64_t offset,
 out:
     bdrv_co_write_req_finish(child, req.offset, req.bytes, &req, ret);
     tracked_request_end(&req);
+    block_node_stats_done(&bs->node_stats, BLOCK_ACCT_UNMAP, start_ns,
+                          req.bytes, ret);
     bdrv_dec_in_flight(bs);
     return ret;
 }
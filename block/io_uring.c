@@ -11,6 +11,8 @@
 #include "qemu/osdep.h"
 #include <liburing.h>
 #include "block/aio.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
 #include "qemu/queue.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
@@ -26,6 +28,9 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Size of the registered file table */
+#define MAX_FIXED_FILES 64
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -58,6 +63,16 @@ struct LuringState {
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /*
+     * Registered file table. Files are registered from the home thread, but
+     * may be unregistered from the main loop, so slot allocation is
+     * protected by fixed_files_lock. nr_fixed_files is 0 if the kernel does
+     * not support registered files.
+     */
+    QemuMutex fixed_files_lock;
+    unsigned int nr_fixed_files;
+    DECLARE_BITMAP(fixed_files_used, MAX_FIXED_FILES);
 };
 
 /**
@@ -326,6 +341,7 @@ static void luring_deferred_fn(void *opaque)
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fixed_file: @fd is an index into the registered file table
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -334,8 +350,8 @@ static void luring_deferred_fn(void *opaque)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, bool fixed_file, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
@@ -361,6 +377,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file) {
+        io_uring_sqe_set_flags(sqes, IOSQE_FIXED_FILE);
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -379,8 +398,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+static int coroutine_fn luring_co_do_submit(BlockDriverState *bs, int fd,
+                                           bool fixed_file, uint64_t offset,
+                                           QEMUIOVector *qiov, int type)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
@@ -391,9 +411,9 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
         .qiov       = qiov,
         .is_read    = (type == QEMU_AIO_READ),
     };
-    trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
-                           type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    trace_luring_co_submit(bs, s, &luringcb, fd, fixed_file, offset,
+                           qiov ? qiov->size : 0, type);
+    ret = luring_do_submit(fd, fixed_file, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -405,6 +425,78 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     return luringcb.ret;
 }
 
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+                                  QEMUIOVector *qiov, int type)
+{
+    return luring_co_do_submit(bs, fd, false, offset, qiov, type);
+}
+
+int coroutine_fn luring_co_submit_fixed(BlockDriverState *bs, int index,
+                                        uint64_t offset, QEMUIOVector *qiov,
+                                        int type)
+{
+    return luring_co_do_submit(bs, index, true, offset, qiov, type);
+}
+
+/**
+ * luring_register_file:
+ * @s: AIO state
+ * @fd: file descriptor to register
+ *
+ * Adds @fd to the registered file table of @s, which saves the kernel the
+ * file table lookup and reference counting for each request. Must be called
+ * from the home thread of @s. The caller must unregister the file with
+ * luring_unregister_file() before closing @fd.
+ *
+ * Returns the index of @fd in the table or -errno.
+ */
+int luring_register_file(LuringState *s, int fd)
+{
+    unsigned int index;
+    int ret;
+
+    if (!s->nr_fixed_files) {
+        return -ENOTSUP;
+    }
+
+    QEMU_LOCK_GUARD(&s->fixed_files_lock);
+
+    index = find_first_zero_bit(s->fixed_files_used, s->nr_fixed_files);
+    if (index >= s->nr_fixed_files) {
+        return -ENOSPC;
+    }
+
+    ret = io_uring_register_files_update(&s->ring, index, &fd, 1);
+    trace_luring_register_file(s, fd, index, ret);
+    if (ret < 0) {
+        return ret;
+    }
+
+    set_bit(index, s->fixed_files_used);
+    return index;
+}
+
+/**
+ * luring_unregister_file:
+ * @s: AIO state
+ * @index: index returned by luring_register_file()
+ *
+ * Removes a file from the registered file table of @s. No requests that
+ * refer to @index may be submitted any more.
+ */
+void luring_unregister_file(LuringState *s, int index)
+{
+    int fd = -1;
+    int ret;
+
+    QEMU_LOCK_GUARD(&s->fixed_files_lock);
+
+    assert(test_bit(index, s->fixed_files_used));
+    ret = io_uring_register_files_update(&s->ring, index, &fd, 1);
+    trace_luring_unregister_file(s, index, ret);
+    clear_bit(index, s->fixed_files_used);
+}
+
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
     aio_set_fd_handler(old_context, s->ring.ring_fd,
@@ -422,22 +514,62 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+static void luring_init_fixed_files(LuringState *s)
+{
+    int fds[MAX_FIXED_FILES];
+    int i, ret;
+
+    qemu_mutex_init(&s->fixed_files_lock);
+
+    /* Start with an empty table, slots are filled on demand */
+    for (i = 0; i < MAX_FIXED_FILES; i++) {
+        fds[i] = -1;
+    }
+
+    ret = io_uring_register_files(&s->ring, fds, MAX_FIXED_FILES);
+    if (ret < 0) {
+        trace_luring_register_files_unsupported(s, ret);
+        return;
+    }
+
+    s->nr_fixed_files = MAX_FIXED_FILES;
+}
+
+/**
+ * luring_init:
+ * @sqpoll: let a kernel thread poll the submission queue, so that
+ *          submitting requests doesn't need a system call while the kernel
+ *          thread is busy
+ * @sqpoll_cpu: CPU to bind the kernel thread to, or -1
+ * @errp: error object
+ */
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        if (sqpoll_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sqpoll_cpu;
+        }
+    }
+
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
-        error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
+        error_setg_errno(errp, -rc, "failed to init linux io_uring ring%s",
+                         sqpoll ? " with submission queue polling" : "");
         g_free(s);
         return NULL;
     }
 
     ioq_init(&s->io_q);
+    luring_init_fixed_files(s);
     return s;
 
 }
@@ -445,6 +577,7 @@ LuringState *luring_init(Error **errp)
 void luring_cleanup(LuringState *s)
 {
     io_uring_queue_exit(&s->ring);
+    qemu_mutex_destroy(&s->fixed_files_lock);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
@@ -16,6 +16,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/range.h"
 #include "trace.h"
+#include "block/aio_task.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
 #include "block/dirty-bitmap.h"
@@ -24,11 +25,23 @@
 #include "qemu/ratelimit.h"
 #include "qemu/bitmap.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* Bounds and sampling interval of the adaptive in-flight limit */
+#define MIRROR_MAX_IN_FLIGHT 64
+#define MIRROR_ADAPT_INTERVAL_NS (500 * SCALE_MS)
+
+/*
+ * The initial allocation scan is done in steps of MIRROR_SCAN_WORKERS ranges
+ * of MIRROR_SCAN_RANGE_BYTES, which are scanned concurrently
+ */
+#define MIRROR_SCAN_WORKERS 8
+#define MIRROR_SCAN_RANGE_BYTES (1 * GiB)
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -82,6 +95,26 @@ typedef struct MirrorBlockJob {
     uint64_t last_pause_ns;
     unsigned long *in_flight_bitmap;
     unsigned in_flight;
+    /*
+     * Limit for in_flight, adjusted by mirror_adapt() between 1 and
+     * max_in_flight_cap.  To be accessed with atomics.
+     */
+    unsigned max_in_flight;
+    unsigned max_in_flight_cap;
+    /* Measurements for the current mirror_adapt() window */
+    int64_t adapt_start_ns;
+    int64_t adapt_remaining;
+    uint64_t adapt_done_bytes;
+    uint64_t adapt_writes;
+    uint64_t adapt_write_ns;
+    bool adapt_limited;
+    /* Lowest average write latency seen recently, slowly decaying */
+    uint64_t min_write_ns;
+    uint64_t prev_throughput;
+    /* Results of the last window in bytes per second, for mirror_query() */
+    bool have_rates;
+    Stat64 throughput;
+    Stat64 dirty_rate;
     int64_t bytes_in_flight;
     QTAILQ_HEAD(, MirrorOp) ops_in_flight;
     int ret;
@@ -89,6 +122,11 @@ typedef struct MirrorBlockJob {
     int target_cluster_size;
     int max_iov;
     bool initial_zeroing_ongoing;
+    /*
+     * The dirty bitmap has been initialised from the allocation status of
+     * the source up to this offset, see mirror_dirty_scan_step()
+     */
+    int64_t dirty_scan_offset;
     int in_active_write_counter;
     int64_t active_write_bytes_in_flight;
     bool prepared;
@@ -221,6 +259,7 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
         }
+        s->adapt_done_bytes += op->bytes;
         if (!s->initial_zeroing_ongoing) {
             job_progress_update(&s->common.job, op->bytes);
         }
@@ -251,6 +290,7 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
 static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
 {
     MirrorBlockJob *s = op->s;
+    int64_t start_ns;
 
     if (ret < 0) {
         BlockErrorAction action;
@@ -265,7 +305,12 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
+    start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0) {
+        s->adapt_write_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns;
+        s->adapt_writes++;
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -488,7 +533,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -600,7 +645,8 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
+            s->adapt_limited = true;
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -836,17 +882,79 @@ static void coroutine_fn mirror_throttle(MirrorBlockJob *s)
     }
 }
 
+/*
+ * Adjust the in-flight limit, and with it the size of the chunks that
+ * mirror_iteration() copies at once, based on the last measurement window.
+ *
+ * The limit is increased as long as it is the bottleneck and throughput keeps
+ * growing.  When the average target write latency exceeds twice the lowest
+ * recently seen latency, the target is considered overloaded and the limit is
+ * decreased.  As long as the guest dirties data faster than it is copied,
+ * more queueing on the target is tolerated so that the job can converge.
+ *
+ * @remaining is the number of bytes that are dirty or in flight.
+ */
+static void mirror_adapt(MirrorBlockJob *s, int64_t remaining)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - s->adapt_start_ns;
+    unsigned max_in_flight = s->max_in_flight;
+    uint64_t avg_write_ns = 0, throughput, dirty_rate;
+    int64_t dirtied;
+    uint32_t elapsed_us;
+
+    if (elapsed < MIRROR_ADAPT_INTERVAL_NS) {
+        return;
+    }
+
+    /* Everything that was copied and is still (or again) dirty was written */
+    dirtied = MAX(remaining - s->adapt_remaining +
+                  (int64_t)s->adapt_done_bytes, 0);
+    elapsed_us = MIN(elapsed / SCALE_US, UINT32_MAX);
+    throughput = muldiv64(s->adapt_done_bytes, 1000000, elapsed_us);
+    dirty_rate = muldiv64(dirtied, 1000000, elapsed_us);
+
+    if (s->adapt_writes) {
+        unsigned overload = dirty_rate < throughput ? 2 : 4;
+
+        avg_write_ns = s->adapt_write_ns / s->adapt_writes;
+        if (!s->min_write_ns || avg_write_ns < s->min_write_ns) {
+            s->min_write_ns = avg_write_ns;
+        } else {
+            s->min_write_ns += (avg_write_ns - s->min_write_ns) / 16;
+        }
+
+        if (avg_write_ns > s->min_write_ns * overload) {
+            max_in_flight = MAX(max_in_flight * 3 / 4, 1);
+        } else if (s->adapt_limited && throughput >= s->prev_throughput) {
+            max_in_flight = MIN(max_in_flight + 1, s->max_in_flight_cap);
+        }
+    }
+
+    if (s->adapt_done_bytes) {
+        stat64_set(&s->throughput, throughput);
+        stat64_set(&s->dirty_rate, dirty_rate);
+        qatomic_set(&s->have_rates, true);
+    } else {
+        qatomic_set(&s->have_rates, false);
+    }
+
+    trace_mirror_adapt(s, max_in_flight, avg_write_ns, throughput, dirty_rate);
+    qatomic_set(&s->max_in_flight, max_in_flight);
+    s->prev_throughput = throughput;
+
+    s->adapt_start_ns = now;
+    s->adapt_remaining = remaining;
+    s->adapt_done_bytes = 0;
+    s->adapt_writes = 0;
+    s->adapt_write_ns = 0;
+    s->adapt_limited = false;
+}
+
 static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
 {
     int64_t offset;
-    BlockDriverState *bs;
     BlockDriverState *target_bs = blk_bs(s->target);
-    int ret;
-    int64_t count;
-
-    bdrv_graph_co_rdlock();
-    bs = s->mirror_top_bs->backing->bs;
-    bdrv_graph_co_rdunlock();
 
     if (s->zero_target) {
         if (!bdrv_can_write_zeroes_with_unmap(target_bs)) {
@@ -866,7 +974,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -881,21 +989,40 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
         s->initial_zeroing_ongoing = false;
     }
 
-    /* First part, loop on the sectors and initialize the dirty bitmap.  */
-    for (offset = 0; offset < s->bdev_length; ) {
+    /* The allocation status is scanned while copying, starting at offset 0 */
+    s->dirty_scan_offset = 0;
+    return 0;
+}
+
+typedef struct MirrorScanTask {
+    AioTask task;
+    MirrorBlockJob *s;
+    BlockDriverState *bs;
+    int64_t offset;
+    int64_t bytes;
+} MirrorScanTask;
+
+static int coroutine_fn mirror_scan_task_entry(AioTask *task)
+{
+    MirrorScanTask *t = container_of(task, MirrorScanTask, task);
+    MirrorBlockJob *s = t->s;
+    int64_t offset = t->offset;
+    int64_t end = t->offset + t->bytes;
+    int64_t count;
+    int ret;
+
+    while (offset < end) {
         /* Just to make sure we are not exceeding int limit. */
-        int bytes = MIN(s->bdev_length - offset,
+        int bytes = MIN(end - offset,
                         QEMU_ALIGN_DOWN(INT_MAX, s->granularity));
 
-        mirror_throttle(s);
-
         if (job_is_cancelled(&s->common.job)) {
             return 0;
         }
 
         WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated_above(bs, s->base_overlay, true, offset,
-                                             bytes, &count);
+            ret = bdrv_co_is_allocated_above(t->bs, s->base_overlay, true,
+                                             offset, bytes, &count);
         }
         if (ret < 0) {
             return ret;
@@ -910,6 +1037,57 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
     return 0;
 }
 
+/*
+ * Initialise the dirty bitmap for the next MIRROR_SCAN_WORKERS *
+ * MIRROR_SCAN_RANGE_BYTES bytes from the allocation status of the source.
+ *
+ * This is called from the main loop of mirror_run() so that the data found
+ * allocated so far is copied while the rest of the image is still being
+ * scanned.  This is safe because setting bits in the dirty bitmap only ever
+ * causes additional copying; data that has been copied before the scan
+ * reaches it is simply copied again.
+ */
+static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_scan_step(MirrorBlockJob *s)
+{
+    BlockDriverState *bs;
+    AioTaskPool *aio;
+    int64_t offset = s->dirty_scan_offset;
+    int64_t end;
+    int ret;
+
+    bdrv_graph_co_rdlock();
+    bs = s->mirror_top_bs->backing->bs;
+    bdrv_graph_co_rdunlock();
+
+    end = MIN(offset + MIRROR_SCAN_WORKERS * MIRROR_SCAN_RANGE_BYTES,
+              s->bdev_length);
+    trace_mirror_dirty_scan_step(s, offset, end - offset);
+
+    aio = aio_task_pool_new(MIRROR_SCAN_WORKERS);
+    while (offset < end && aio_task_pool_status(aio) == 0) {
+        MirrorScanTask *task = g_new(MirrorScanTask, 1);
+
+        *task = (MirrorScanTask) {
+            .task.func  = mirror_scan_task_entry,
+            .s          = s,
+            .bs         = bs,
+            .offset     = offset,
+            .bytes      = MIN(end - offset, MIRROR_SCAN_RANGE_BYTES),
+        };
+        offset += task->bytes;
+        aio_task_pool_start_task(aio, &task->task);
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    aio_task_pool_free(aio);
+
+    if (ret < 0) {
+        return ret;
+    }
+    s->dirty_scan_offset = end;
+    return 0;
+}
+
 /* Called when going out of the streaming phase to flush the bulk of the
  * data to the medium, or just before completing.
  */
@@ -1019,7 +1197,12 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     mirror_free_init(s);
 
+    s->max_in_flight_cap = MAX(MIN(s->buf_size / s->granularity,
+                                   MIRROR_MAX_IN_FLIGHT), 1);
+    qatomic_set(&s->max_in_flight, MIN(MAX_IN_FLIGHT, s->max_in_flight_cap));
+
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->dirty_scan_offset = s->bdev_length;
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
@@ -1035,6 +1218,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
 
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
+    s->adapt_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->adapt_remaining = s->bytes_in_flight +
+                         bdrv_get_dirty_count(s->dirty_bitmap);
+    s->adapt_done_bytes = 0;
     for (;;) {
         int64_t cnt, delta;
         bool should_complete;
@@ -1051,6 +1238,17 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             goto immediate_exit;
         }
 
+        if (s->dirty_scan_offset < s->bdev_length) {
+            ret = mirror_dirty_scan_step(s);
+            if (ret < 0) {
+                goto immediate_exit;
+            }
+            if (job_is_cancelled(&s->common.job)) {
+                ret = 0;
+                goto immediate_exit;
+            }
+        }
+
         cnt = bdrv_get_dirty_count(s->dirty_bitmap);
         /* cnt is the number of dirty bytes remaining and s->bytes_in_flight is
          * the number of bytes currently being processed; together those are
@@ -1058,6 +1256,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         job_progress_set_remaining(&s->common.job,
                                    s->bytes_in_flight + cnt +
                                    s->active_write_bytes_in_flight);
+        mirror_adapt(s, s->bytes_in_flight + cnt);
 
         /* Note that even when no rate limit is applied we need to yield
          * periodically with no pending I/O so that bdrv_drain_all() returns.
@@ -1069,8 +1268,9 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
+                s->adapt_limited |= s->in_flight >= s->max_in_flight;
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
@@ -1080,7 +1280,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
 
         should_complete = false;
-        if (s->in_flight == 0 && cnt == 0) {
+        if (s->in_flight == 0 && cnt == 0 &&
+            s->dirty_scan_offset == s->bdev_length) {
             trace_mirror_before_flush(s);
             if (!job_is_ready(&s->common.job)) {
                 if (mirror_flush(s) < 0) {
@@ -1295,9 +1496,36 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
 {
     MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
 
+    uint64_t current, total, remaining, throughput, dirty_rate;
+
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
     };
+
+    /* The adaptive state is only meaningful while there is data to copy */
+    progress_get_snapshot(&job->job.progress, &current, &total);
+    remaining = total - current;
+    if (!remaining || !qatomic_read(&s->max_in_flight)) {
+        return;
+    }
+
+    info->u.mirror.has_in_flight_limit = true;
+    info->u.mirror.in_flight_limit = qatomic_read(&s->max_in_flight);
+
+    if (!qatomic_read(&s->have_rates)) {
+        return;
+    }
+    throughput = stat64_get(&s->throughput);
+    dirty_rate = stat64_get(&s->dirty_rate);
+    info->u.mirror.has_throughput = true;
+    info->u.mirror.throughput = throughput;
+    info->u.mirror.has_dirty_rate = true;
+    info->u.mirror.dirty_rate = dirty_rate;
+    if (throughput > dirty_rate) {
+        info->u.mirror.has_time_to_sync = true;
+        info->u.mirror.time_to_sync =
+            DIV_ROUND_UP(remaining, throughput - dirty_rate);
+    }
 }
 
 static const BlockJobDriver mirror_job_driver = {
@@ -23,6 +23,7 @@
 #include "qemu/cutils.h"
 #include "qemu/option.h"
 #include "qemu/memalign.h"
+#include "qemu/xxhash.h"
 #include "qemu/vfio-helpers.h"
 #include "block/block-io.h"
 #include "block/block_int.h"
@@ -49,6 +50,9 @@ typedef struct BDRVNVMeState BDRVNVMeState;
 #define INDEX_ADMIN     0
 #define INDEX_IO(n)     (1 + n)
 
+/* Upper bound for the io-queues option */
+#define NVME_MAX_IO_QUEUES 64
+
 /* This driver shares a single MSIX IRQ for the admin and I/O queues */
 enum {
     MSIX_SHARED_IRQ_IDX = 0,
@@ -66,6 +70,7 @@ typedef struct {
 typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
+    uint32_t *result; /* if non-NULL, receives Dword 0 of the completion */
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -110,6 +115,12 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /*
+     * AioContexts that have claimed an I/O queue pair, indexed like
+     * queues[INDEX_IO(n)].  Slots are claimed with atomic cmpxchg on first
+     * submission from an AioContext and never released while open.
+     */
+    AioContext **io_queue_ctx;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -143,6 +154,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_IO_QUEUES "io-queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -160,6 +172,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_IO_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs to create (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -430,8 +447,12 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         nvme_put_free_req_locked(q, preq);
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         q->inflight--;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, ret);
@@ -517,7 +538,12 @@ static void nvme_admin_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
-static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+/*
+ * Run an admin command and wait for its completion.  If @result is non-NULL,
+ * it receives Dword 0 of the completion queue entry.
+ */
+static int nvme_admin_cmd_sync_result(BlockDriverState *bs, NvmeCmd *cmd,
+                                      uint32_t *result)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q = s->queues[INDEX_ADMIN];
@@ -528,12 +554,18 @@ static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(q, req, cmd, nvme_admin_cmd_sync_cb, &ret);
 
     AIO_WAIT_WHILE(aio_context, ret == -EINPROGRESS);
     return ret;
 }
 
+static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+{
+    return nvme_admin_cmd_sync_result(bs, cmd, NULL);
+}
+
 /* Returns true on success, false on failure. */
 static bool nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
@@ -675,6 +707,11 @@ static bool nvme_add_io_queue(BlockDriverState *bs, Error **errp)
     unsigned queue_size = NVME_QUEUE_SIZE;
 
     assert(n <= UINT16_MAX);
+    if ((n + 1) * s->doorbell_scale * sizeof(*s->doorbells) >
+        NVME_DOORBELL_SIZE) {
+        error_setg(errp, "No doorbell space for io queue [%u]", n);
+        return false;
+    }
     q = nvme_create_queue_pair(s, bdrv_get_aio_context(bs),
                                n, queue_size, errp);
     if (!q) {
@@ -709,6 +746,77 @@ out_error:
     return false;
 }
 
+/*
+ * Ask the controller for @nr_io_queues I/O submission and completion queues.
+ * The controller may allocate fewer; Dword 0 of the completion holds the
+ * number of submission (bits 15:0) and completion queues (bits 31:16) it
+ * allocated, both 0's based.
+ *
+ * Returns the number of I/O queue pairs that can be created, or -errno on
+ * failure.
+ */
+static int nvme_set_num_queues(BlockDriverState *bs, unsigned nr_io_queues,
+                               Error **errp)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((nr_io_queues - 1) << 16) | (nr_io_queues - 1)),
+    };
+    uint32_t result = 0;
+    unsigned nsqa, ncqa;
+    int ret;
+
+    ret = nvme_admin_cmd_sync_result(bs, &cmd, &result);
+    if (ret) {
+        error_setg_errno(errp, -ret, "Failed to set the number of queues");
+        return ret;
+    }
+
+    nsqa = (result & 0xffff) + 1;
+    ncqa = (result >> 16) + 1;
+    trace_nvme_set_num_queues(bs->opaque, nr_io_queues, nsqa, ncqa);
+
+    return MIN(nr_io_queues, MIN(nsqa, ncqa));
+}
+
+/*
+ * Pick the I/O queue pair for the current AioContext.  Each AioContext that
+ * submits requests claims its own queue pair while free ones are left, so
+ * that iothreads of a multi-queue device do not contend on q->lock and the
+ * submission queue doorbell.  Once all queue pairs are claimed, further
+ * AioContexts share them.
+ */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    unsigned nr_io_queues = s->queue_count - 1;
+    AioContext *ctx;
+    unsigned i;
+
+    assert(nr_io_queues > 0);
+    if (nr_io_queues == 1) {
+        return s->queues[INDEX_IO(0)];
+    }
+
+    ctx = qemu_get_current_aio_context();
+    for (i = 0; i < nr_io_queues; i++) {
+        AioContext *owner = qatomic_read(&s->io_queue_ctx[i]);
+
+        if (owner == ctx) {
+            return s->queues[INDEX_IO(i)];
+        }
+        if (!owner) {
+            owner = qatomic_cmpxchg(&s->io_queue_ctx[i], NULL, ctx);
+            if (!owner || owner == ctx) {
+                trace_nvme_claim_io_queue(s, INDEX_IO(i), ctx);
+                return s->queues[INDEX_IO(i)];
+            }
+        }
+    }
+
+    return s->queues[INDEX_IO(qemu_xxhash2((uintptr_t)ctx) % nr_io_queues)];
+}
+
 static bool nvme_poll_cb(void *opaque)
 {
     EventNotifier *e = opaque;
@@ -741,7 +849,7 @@ static void nvme_poll_ready(EventNotifier *e)
 }
 
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned nr_io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -881,9 +989,25 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
     }
 
     /* Set up command queues. */
-    if (!nvme_add_io_queue(bs, errp)) {
-        ret = -EIO;
+    if (nr_io_queues > 1) {
+        ret = nvme_set_num_queues(bs, nr_io_queues, errp);
+        if (ret < 0) {
+            goto out;
+        }
+        if (ret < nr_io_queues) {
+            warn_report("NVMe: controller allocated %d of %u I/O queues",
+                        ret, nr_io_queues);
+            nr_io_queues = ret;
+        }
+        ret = 0;
+    }
+    while (s->queue_count - 1 < nr_io_queues) {
+        if (!nvme_add_io_queue(bs, errp)) {
+            ret = -EIO;
+            goto out;
+        }
     }
+    s->io_queue_ctx = g_new0(AioContext *, s->queue_count - 1);
 out:
     if (regs) {
         qemu_vfio_pci_unmap_bar(s->vfio, 0, (void *)regs, 0, sizeof(NvmeBar));
@@ -956,6 +1080,7 @@ static void nvme_close(BlockDriverState *bs)
         nvme_free_queue_pair(s->queues[i]);
     }
     g_free(s->queues);
+    g_free(s->io_queue_ctx);
     aio_set_event_notifier(bdrv_get_aio_context(bs),
                            &s->irq_notifier[MSIX_SHARED_IRQ_IDX],
                            NULL, NULL, NULL);
@@ -973,6 +1098,7 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t nr_io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -988,7 +1114,14 @@ static int nvme_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_IO_QUEUES, 1);
+    if (nr_io_queues < 1 || nr_io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_IO_QUEUES "' must be between 1 "
+                   "and %d", NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, nr_io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1188,7 +1321,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1309,7 +1442,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1340,7 +1473,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1403,7 +1536,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq = nvme_get_io_queue(s);
     NVMeRequest *req;
     QEMU_AUTO_VFREE NvmeDsmRange *buf = NULL;
     QEMUIOVector local_qiov;
@@ -36,8 +36,10 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qapi/qmp/qdict.h"
+#include "qemu/module.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/blockdev.h"
+#include "sysemu/stats.h"
 
 static BlockBackend *qmp_get_blk(const char *blk_name, const char *qdev_id,
                                  Error **errp)
@@ -572,3 +574,196 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+/*
+ * query-stats provider for per-node request statistics.  Every node in the
+ * graph, not only those attached to a BlockBackend, reports one set of
+ * counters per request type; this shows whether latency is added by a
+ * format driver, a filter or the protocol node underneath.
+ */
+
+static const struct {
+    enum BlockAcctType type;
+    const char *name;
+    bool has_bytes;
+} block_node_stats_ops[] = {
+    { BLOCK_ACCT_READ,  "read",  true },
+    { BLOCK_ACCT_WRITE, "write", true },
+    { BLOCK_ACCT_FLUSH, "flush", false },
+    { BLOCK_ACCT_UNMAP, "unmap", true },
+};
+
+typedef enum BlockNodeStatsField {
+    BLOCK_NODE_STATS_OPS,
+    BLOCK_NODE_STATS_BYTES,
+    BLOCK_NODE_STATS_FAILED_OPS,
+    BLOCK_NODE_STATS_TOTAL_TIME,
+    BLOCK_NODE_STATS_IN_FLIGHT,
+    BLOCK_NODE_STATS_LATENCY,
+    BLOCK_NODE_STATS__MAX,
+} BlockNodeStatsField;
+
+static const struct {
+    const char *suffix;
+    StatsType type;
+    bool has_unit;
+    StatsUnit unit;
+    int exponent;
+} block_node_stats_fields[BLOCK_NODE_STATS__MAX] = {
+    [BLOCK_NODE_STATS_OPS] = { "ops", STATS_TYPE_CUMULATIVE },
+    [BLOCK_NODE_STATS_BYTES] = {
+        "bytes", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_BYTES,
+    },
+    [BLOCK_NODE_STATS_FAILED_OPS] = { "failed-ops", STATS_TYPE_CUMULATIVE },
+    [BLOCK_NODE_STATS_TOTAL_TIME] = {
+        "total-time", STATS_TYPE_CUMULATIVE, true, STATS_UNIT_SECONDS, -9,
+    },
+    [BLOCK_NODE_STATS_IN_FLIGHT] = { "in-flight", STATS_TYPE_INSTANT },
+    [BLOCK_NODE_STATS_LATENCY] = {
+        "latency", STATS_TYPE_LOG2_HISTOGRAM, true, STATS_UNIT_SECONDS, -9,
+    },
+};
+
+static char *block_node_stats_name(int op, BlockNodeStatsField field)
+{
+    return g_strdup_printf("%s-%s", block_node_stats_ops[op].name,
+                           block_node_stats_fields[field].suffix);
+}
+
+static Stats *block_node_stats_get(BlockNodeOpStats *s,
+                                   BlockNodeStatsField field, char *name)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = name;
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+
+    switch (field) {
+    case BLOCK_NODE_STATS_OPS:
+        stats->value->u.scalar = stat64_get(&s->nr_ops);
+        break;
+    case BLOCK_NODE_STATS_BYTES:
+        stats->value->u.scalar = stat64_get(&s->nr_bytes);
+        break;
+    case BLOCK_NODE_STATS_FAILED_OPS:
+        stats->value->u.scalar = stat64_get(&s->failed_ops);
+        break;
+    case BLOCK_NODE_STATS_TOTAL_TIME:
+        stats->value->u.scalar = stat64_get(&s->total_time_ns);
+        break;
+    case BLOCK_NODE_STATS_IN_FLIGHT:
+        stats->value->u.scalar = qatomic_read(&s->in_flight);
+        break;
+    case BLOCK_NODE_STATS_LATENCY: {
+        uint64List **tail = &stats->value->u.list;
+        int i;
+
+        stats->value->type = QTYPE_QLIST;
+        for (i = 0; i < BLOCK_NODE_LATENCY_BUCKETS; i++) {
+            QAPI_LIST_APPEND(tail, stat64_get(&s->latency_log2[i]));
+        }
+        break;
+    }
+    default:
+        g_assert_not_reached();
+    }
+
+    return stats;
+}
+
+static void block_node_stats_cb(StatsResultList **result, StatsTarget target,
+                                strList *names, strList *targets,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+
+    GLOBAL_STATE_CODE();
+
+    if (target != STATS_TARGET_BLOCK_NODE) {
+        return;
+    }
+
+    for (bs = bdrv_next_all_states(NULL); bs; bs = bdrv_next_all_states(bs)) {
+        StatsList *stats_list = NULL;
+        StatsList **tail = &stats_list;
+        StatsResult *entry;
+        int op;
+        BlockNodeStatsField field;
+
+        if (!apply_str_list_filter(bs->node_name, targets)) {
+            continue;
+        }
+
+        for (op = 0; op < ARRAY_SIZE(block_node_stats_ops); op++) {
+            BlockNodeOpStats *s =
+                &bs->node_stats.op[block_node_stats_ops[op].type];
+
+            for (field = 0; field < BLOCK_NODE_STATS__MAX; field++) {
+                char *name;
+
+                if (field == BLOCK_NODE_STATS_BYTES &&
+                    !block_node_stats_ops[op].has_bytes) {
+                    continue;
+                }
+                name = block_node_stats_name(op, field);
+                if (!apply_str_list_filter(name, names)) {
+                    g_free(name);
+                    continue;
+                }
+                QAPI_LIST_APPEND(tail, block_node_stats_get(s, field, name));
+            }
+        }
+
+        if (!stats_list) {
+            continue;
+        }
+        entry = g_new0(StatsResult, 1);
+        entry->provider = STATS_PROVIDER_BLOCK;
+        entry->node_name = g_strdup(bs->node_name);
+        entry->stats = stats_list;
+        QAPI_LIST_PREPEND(*result, entry);
+    }
+}
+
+static void block_node_stats_schemas_cb(StatsSchemaList **result,
+                                        Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+    StatsSchemaValueList **tail = &stats_list;
+    int op;
+    BlockNodeStatsField field;
+
+    for (op = 0; op < ARRAY_SIZE(block_node_stats_ops); op++) {
+        for (field = 0; field < BLOCK_NODE_STATS__MAX; field++) {
+            StatsSchemaValue *value;
+
+            if (field == BLOCK_NODE_STATS_BYTES &&
+                !block_node_stats_ops[op].has_bytes) {
+                continue;
+            }
+            value = g_new0(StatsSchemaValue, 1);
+            value->name = block_node_stats_name(op, field);
+            value->type = block_node_stats_fields[field].type;
+            value->has_unit = block_node_stats_fields[field].has_unit;
+            value->unit = block_node_stats_fields[field].unit;
+            value->exponent = block_node_stats_fields[field].exponent;
+            if (value->exponent) {
+                value->has_base = true;
+                value->base = 10;
+            }
+            QAPI_LIST_APPEND(tail, value);
+        }
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_BLOCK, STATS_TARGET_BLOCK_NODE,
+                     stats_list);
+}
+
+static void block_node_stats_init(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_BLOCK, block_node_stats_cb,
+                        block_node_stats_schemas_cb);
+}
+
+block_init(block_node_stats_init);
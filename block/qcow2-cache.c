@@ -25,6 +25,8 @@
 #include "qemu/osdep.h"
 #include "block/block-io.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
+#include "qemu/xxhash.h"
 #include "qcow2.h"
 #include "trace.h"
 
@@ -33,6 +35,12 @@ typedef struct Qcow2CachedTable {
     uint64_t lru_counter;
     int      ref;
     bool     dirty;
+
+    /* Next entry in the same hash bucket, -1 terminates the chain */
+    int      hash_next;
+
+    /* Linked into Qcow2Cache.lru_list while ref == 0 */
+    QTAILQ_ENTRY(Qcow2CachedTable) lru_entry;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,6 +52,30 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /*
+     * Hash index from table offset to entry index. Only entries with a
+     * non-zero offset are linked into a bucket.
+     */
+    int                    *hash_buckets;
+    unsigned                hash_mask;
+
+    /*
+     * Unreferenced entries, least recently used first. Empty entries are
+     * kept at the head so that they are reused before any cached table is
+     * evicted.
+     */
+    QTAILQ_HEAD(, Qcow2CachedTable) lru_list;
+
+    uint64_t                hits;
+    uint64_t                misses;
+
+    /*
+     * Time spent in successful lookups, in nanoseconds.  Only measured
+     * while the qcow2_cache_destroy trace event that reports it is enabled.
+     */
+    uint64_t                hit_ns;
+    uint64_t                miss_ns;
 };
 
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
@@ -59,6 +91,65 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return qemu_xxhash2(offset / c->table_size) & c->hash_mask;
+}
+
+static int qcow2_cache_hash_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->hash_buckets[qcow2_cache_hash(c, offset)]; i >= 0;
+         i = c->entries[i].hash_next)
+    {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void qcow2_cache_hash_insert(Qcow2Cache *c, int i)
+{
+    unsigned bucket = qcow2_cache_hash(c, c->entries[i].offset);
+
+    assert(c->entries[i].offset != 0);
+    c->entries[i].hash_next = c->hash_buckets[bucket];
+    c->hash_buckets[bucket] = i;
+}
+
+static void qcow2_cache_hash_remove(Qcow2Cache *c, int i)
+{
+    int *p;
+
+    if (c->entries[i].offset == 0) {
+        return;
+    }
+
+    p = &c->hash_buckets[qcow2_cache_hash(c, c->entries[i].offset)];
+    while (*p != i) {
+        assert(*p >= 0);
+        p = &c->entries[*p].hash_next;
+    }
+    *p = c->entries[i].hash_next;
+    c->entries[i].hash_next = -1;
+}
+
+/* Drop the table held by unreferenced entry @i and mark it for reuse */
+static void qcow2_cache_entry_reset(Qcow2Cache *c, int i)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+
+    assert(t->ref == 0);
+    qcow2_cache_hash_remove(c, i);
+    t->offset = 0;
+    t->lru_counter = 0;
+
+    QTAILQ_REMOVE(&c->lru_list, t, lru_entry);
+    QTAILQ_INSERT_HEAD(&c->lru_list, t, lru_entry);
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +197,7 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_entry_reset(c, i);
             i++;
             to_clean++;
         }
@@ -125,6 +215,8 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    unsigned hash_size;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -138,11 +230,24 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Keep the load factor of the hash index at or below 1 */
+    hash_size = pow2ceil(num_tables);
+    c->hash_mask = hash_size - 1;
+    c->hash_buckets = g_try_new(int, hash_size);
+
+    if (!c->entries || !c->table_array || !c->hash_buckets) {
         qemu_vfree(c->table_array);
+        g_free(c->hash_buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    memset(c->hash_buckets, -1, sizeof(int) * hash_size);
+    QTAILQ_INIT(&c->lru_list);
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
+        QTAILQ_INSERT_TAIL(&c->lru_list, &c->entries[i], lru_entry);
     }
 
     return c;
@@ -156,7 +261,12 @@ int qcow2_cache_destroy(Qcow2Cache *c)
         assert(c->entries[i].ref == 0);
     }
 
+    trace_qcow2_cache_destroy(c, c->hits, c->misses,
+                              c->hits ? c->hit_ns / c->hits : 0,
+                              c->misses ? c->miss_ns / c->misses : 0);
+
     qemu_vfree(c->table_array);
+    g_free(c->hash_buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -307,10 +417,14 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
         return ret;
     }
 
+    memset(c->hash_buckets, -1, sizeof(int) * (c->hash_mask + 1));
+    QTAILQ_INIT(&c->lru_list);
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
         c->entries[i].offset = 0;
         c->entries[i].lru_counter = 0;
+        c->entries[i].hash_next = -1;
+        QTAILQ_INSERT_TAIL(&c->lru_list, &c->entries[i], lru_entry);
     }
 
     qcow2_cache_table_release(c, 0, c->size);
@@ -325,14 +439,18 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
                    void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
+    Qcow2CachedTable *t;
+    int64_t start_ns = 0;
+    bool hit;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
+    if (trace_event_get_state_backends(TRACE_QCOW2_CACHE_DESTROY)) {
+        start_ns = get_clock();
+    }
+
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
@@ -344,29 +462,23 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_hash_lookup(c, offset);
+    hit = i >= 0;
+    if (hit) {
+        c->hits++;
+        goto found;
+    }
+    c->misses++;
 
-    if (min_lru_index == -1) {
+    t = QTAILQ_FIRST(&c->lru_list);
+    if (!t) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
+    i = t - c->entries;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,6 +489,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
+    qcow2_cache_hash_remove(c, i);
     c->entries[i].offset = 0;
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
@@ -391,12 +504,23 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     c->entries[i].offset = offset;
+    qcow2_cache_hash_insert(c, i);
 
     /* And return the right table */
 found:
-    c->entries[i].ref++;
+    if (c->entries[i].ref++ == 0) {
+        QTAILQ_REMOVE(&c->lru_list, &c->entries[i], lru_entry);
+    }
     *table = qcow2_cache_get_table_addr(c, i);
 
+    if (start_ns) {
+        if (hit) {
+            c->hit_ns += get_clock() - start_ns;
+        } else {
+            c->miss_ns += get_clock() - start_ns;
+        }
+    }
+
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
 
@@ -424,6 +548,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        QTAILQ_INSERT_TAIL(&c->lru_list, &c->entries[i], lru_entry);
     }
 
     assert(c->entries[i].ref >= 0);
@@ -440,12 +565,12 @@ void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
     int i;
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
-            return qcow2_cache_get_table_addr(c, i);
-        }
+    if (offset == 0) {
+        return NULL;
     }
-    return NULL;
+
+    i = qcow2_cache_hash_lookup(c, offset);
+    return i >= 0 ? qcow2_cache_get_table_addr(c, i) : NULL;
 }
 
 void qcow2_cache_discard(Qcow2Cache *c, void *table)
@@ -454,8 +579,7 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
-    c->entries[i].lru_counter = 0;
+    qcow2_cache_entry_reset(c, i);
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
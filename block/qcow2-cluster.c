@@ -1620,8 +1620,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
     if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
+        int64_t cluster_offset = qcow2_alloc_data_clusters(bs, nb_clusters);
         if (cluster_offset < 0) {
             return cluster_offset;
         }
@@ -1893,6 +1892,53 @@ again:
     return 0;
 }
 
+/*
+ * Decreases the refcount of the host clusters in [*free_offset,
+ * *free_offset + *free_bytes) and resets the range.
+ */
+static void GRAPH_RDLOCK
+free_cluster_run(BlockDriverState *bs, uint64_t *free_offset,
+                 uint64_t *free_bytes, enum qcow2_discard_type type)
+{
+    if (*free_bytes) {
+        qcow2_free_clusters(bs, *free_offset, *free_bytes, type);
+        *free_bytes = 0;
+    }
+}
+
+/*
+ * Like qcow2_free_any_cluster(), but host clusters that directly follow the
+ * range [*free_offset, *free_offset + *free_bytes) are only appended to it,
+ * so that a whole run of contiguous clusters can be freed with a single
+ * refcount update. The caller must call free_cluster_run() for the last run
+ * once it is done.
+ */
+static void GRAPH_RDLOCK
+free_any_cluster_batched(BlockDriverState *bs, uint64_t l2_entry,
+                         uint64_t *free_offset, uint64_t *free_bytes,
+                         enum qcow2_discard_type type)
+{
+    BDRVQcow2State *s = bs->opaque;
+    QCow2ClusterType ctype = qcow2_get_cluster_type(bs, l2_entry);
+    uint64_t host_offset = l2_entry & L2E_OFFSET_MASK;
+
+    if (has_data_file(bs) || offset_into_cluster(s, host_offset) ||
+        (ctype != QCOW2_CLUSTER_NORMAL && ctype != QCOW2_CLUSTER_ZERO_ALLOC))
+    {
+        qcow2_free_any_cluster(bs, l2_entry, type);
+        return;
+    }
+
+    if (*free_bytes && *free_offset + *free_bytes == host_offset) {
+        *free_bytes += s->cluster_size;
+        return;
+    }
+
+    free_cluster_run(bs, free_offset, free_bytes, type);
+    *free_offset = host_offset;
+    *free_bytes = s->cluster_size;
+}
+
 /*
  * This discards as many clusters of nb_clusters as possible at once (i.e.
  * all clusters in the same L2 slice) and returns the number of discarded
@@ -1904,6 +1950,7 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l2_slice;
+    uint64_t free_offset = 0, free_bytes = 0;
     int l2_index;
     int ret;
     int i;
@@ -1977,7 +2024,8 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
         }
         if (!keep_reference) {
             /* Then decrease the refcount */
-            qcow2_free_any_cluster(bs, old_l2_entry, type);
+            free_any_cluster_batched(bs, old_l2_entry, &free_offset,
+                                     &free_bytes, type);
         } else if (s->discard_passthrough[type] &&
                    (cluster_type == QCOW2_CLUSTER_NORMAL ||
                     cluster_type == QCOW2_CLUSTER_ZERO_ALLOC)) {
@@ -1987,6 +2035,7 @@ discard_in_l2_slice(BlockDriverState *bs, uint64_t offset, uint64_t nb_clusters,
         }
     }
 
+    free_cluster_run(bs, &free_offset, &free_bytes, type);
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     return nb_clusters;
@@ -2043,6 +2092,7 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t *l2_slice;
+    uint64_t free_offset = 0, free_bytes = 0;
     int l2_index;
     int ret;
     int i;
@@ -2091,7 +2141,8 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
         if (unmap) {
             if (!keep_reference) {
                 /* Then decrease the refcount */
-                qcow2_free_any_cluster(bs, old_l2_entry, QCOW2_DISCARD_REQUEST);
+                free_any_cluster_batched(bs, old_l2_entry, &free_offset,
+                                         &free_bytes, QCOW2_DISCARD_REQUEST);
             } else if (s->discard_passthrough[QCOW2_DISCARD_REQUEST] &&
                        (type == QCOW2_CLUSTER_NORMAL ||
                         type == QCOW2_CLUSTER_ZERO_ALLOC)) {
@@ -2102,6 +2153,7 @@ zero_in_l2_slice(BlockDriverState *bs, uint64_t offset,
         }
     }
 
+    free_cluster_run(bs, &free_offset, &free_bytes, QCOW2_DISCARD_REQUEST);
     qcow2_cache_put(s->l2_table_cache, (void **) &l2_slice);
 
     return nb_clusters;
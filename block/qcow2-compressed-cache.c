@@ -0,0 +1,324 @@
+/*
+ * Cache of decompressed clusters and compressed data readahead for qcow2
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Compressed clusters are immutable: a guest write to a compressed cluster
+ * always allocates a new cluster.  The host offset of the compressed data
+ * can therefore be used as the cache key, as long as entries are dropped
+ * whenever the refcount of the host range they came from changes (the
+ * range is freed, or free space is allocated for new data).
+ *
+ * Compressed reads run without s->lock, possibly in several threads, so
+ * the cache has its own mutex.  It is only held for lookups and copies.
+ * A request that misses records the cache generation before doing I/O and
+ * only inserts its result if no invalidation happened in the meantime.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/xxhash.h"
+#include "qcow2.h"
+#include "trace.h"
+
+struct Qcow2CompressedCacheEntry {
+    /* [offset, offset] of the compressed data, in the tree while in use */
+    IntervalTreeNode node;
+
+    /* Next entry in the same hash bucket, -1 terminates the chain */
+    int hash_next;
+
+    QTAILQ_ENTRY(Qcow2CompressedCacheEntry) lru_entry;
+};
+
+static inline unsigned qcow2_compressed_cache_hash(Qcow2CompressedCache *c,
+                                                   uint64_t offset)
+{
+    return qemu_xxhash2(offset) & c->hash_mask;
+}
+
+/* With c->lock */
+static int qcow2_compressed_cache_lookup(Qcow2CompressedCache *c,
+                                         uint64_t offset)
+{
+    int i;
+
+    for (i = c->hash_buckets[qcow2_compressed_cache_hash(c, offset)]; i >= 0;
+         i = c->entries[i].hash_next)
+    {
+        if (c->entries[i].node.start == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Use entry @i for the data at @offset.  With c->lock */
+static void qcow2_compressed_cache_link(Qcow2CompressedCache *c, int i,
+                                        uint64_t offset)
+{
+    Qcow2CompressedCacheEntry *e = &c->entries[i];
+    unsigned bucket = qcow2_compressed_cache_hash(c, offset);
+
+    assert(offset != 0 && e->node.start == 0);
+    e->node.start = offset;
+    e->node.last = offset;
+    interval_tree_insert(&e->node, &c->tree);
+    e->hash_next = c->hash_buckets[bucket];
+    c->hash_buckets[bucket] = i;
+}
+
+/* Free entry @i and make it the first to be reused.  With c->lock */
+static void qcow2_compressed_cache_unlink(Qcow2CompressedCache *c, int i)
+{
+    Qcow2CompressedCacheEntry *e = &c->entries[i];
+    int *p;
+
+    if (e->node.start == 0) {
+        return;
+    }
+
+    p = &c->hash_buckets[qcow2_compressed_cache_hash(c, e->node.start)];
+    while (*p != i) {
+        assert(*p >= 0);
+        p = &c->entries[*p].hash_next;
+    }
+    *p = e->hash_next;
+    e->hash_next = -1;
+
+    interval_tree_remove(&e->node, &c->tree);
+    e->node.start = 0;
+    e->node.last = 0;
+
+    QTAILQ_REMOVE(&c->lru_list, e, lru_entry);
+    QTAILQ_INSERT_HEAD(&c->lru_list, e, lru_entry);
+}
+
+void qcow2_compressed_cache_init(BDRVQcow2State *s)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+
+    memset(c, 0, sizeof(*c));
+    qemu_mutex_init(&c->lock);
+    QTAILQ_INIT(&c->lru_list);
+}
+
+/* With c->lock */
+static void qcow2_compressed_cache_drop_locked(Qcow2CompressedCache *c)
+{
+    g_free(c->entries);
+    g_free(c->hash_buckets);
+    g_free(c->data);
+    g_free(c->ra_buf);
+    c->entries = NULL;
+    c->hash_buckets = NULL;
+    c->hash_mask = 0;
+    c->tree = (IntervalTreeRoot) { };
+    QTAILQ_INIT(&c->lru_list);
+    c->data = NULL;
+    c->ra_buf = NULL;
+    c->ra_offset = 0;
+    c->ra_bytes = 0;
+    qatomic_set(&c->size, 0);
+    c->generation++;
+}
+
+void qcow2_compressed_cache_destroy(BDRVQcow2State *s)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+
+    qemu_mutex_lock(&c->lock);
+    qcow2_compressed_cache_drop_locked(c);
+    qemu_mutex_unlock(&c->lock);
+    qemu_mutex_destroy(&c->lock);
+}
+
+/*
+ * Resize the cache to hold @num_clusters decompressed clusters, dropping
+ * all cached data.  0 disables both the cache and readahead.
+ */
+int qcow2_compressed_cache_resize(BDRVQcow2State *s, int num_clusters)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+    uint8_t *data = NULL;
+    unsigned hash_size = 0;
+    int i;
+
+    if (num_clusters) {
+        data = g_try_malloc((size_t)num_clusters * s->cluster_size);
+        if (!data) {
+            return -ENOMEM;
+        }
+        hash_size = pow2ceil(num_clusters);
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    qcow2_compressed_cache_drop_locked(c);
+    if (num_clusters) {
+        qatomic_set(&c->size, num_clusters);
+        c->entries = g_new0(Qcow2CompressedCacheEntry, num_clusters);
+        c->data = data;
+        c->hash_mask = hash_size - 1;
+        c->hash_buckets = g_new(int, hash_size);
+        for (i = 0; i < hash_size; i++) {
+            c->hash_buckets[i] = -1;
+        }
+        for (i = 0; i < num_clusters; i++) {
+            c->entries[i].hash_next = -1;
+            QTAILQ_INSERT_TAIL(&c->lru_list, &c->entries[i], lru_entry);
+        }
+    }
+    return 0;
+}
+
+bool qcow2_compressed_cache_enabled(BDRVQcow2State *s)
+{
+    return qatomic_read(&s->compressed_cache.size) > 0;
+}
+
+/*
+ * Copy the decompressed cluster whose compressed data is at @coffset into
+ * @buf and return true, or return false on a miss.  In both cases *@gen is
+ * set to the generation to pass to qcow2_compressed_cache_put().
+ */
+bool qcow2_compressed_cache_get(BDRVQcow2State *s, uint64_t coffset,
+                                void *buf, uint64_t *gen)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+    Qcow2CompressedCacheEntry *e;
+    int i;
+
+    if (!qcow2_compressed_cache_enabled(s)) {
+        *gen = 0;
+        return false;
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    *gen = c->generation;
+    i = qcow2_compressed_cache_lookup(c, coffset);
+    if (i < 0) {
+        return false;
+    }
+
+    memcpy(buf, c->data + (size_t)i * s->cluster_size, s->cluster_size);
+    e = &c->entries[i];
+    QTAILQ_REMOVE(&c->lru_list, e, lru_entry);
+    QTAILQ_INSERT_TAIL(&c->lru_list, e, lru_entry);
+    trace_qcow2_compressed_cache_hit(s, coffset);
+    return true;
+}
+
+void qcow2_compressed_cache_put(BDRVQcow2State *s, uint64_t coffset,
+                                const void *buf, uint64_t gen)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+    Qcow2CompressedCacheEntry *e;
+    int i;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    if (!c->size || c->generation != gen) {
+        return;
+    }
+    if (qcow2_compressed_cache_lookup(c, coffset) >= 0) {
+        /* Another request was faster */
+        return;
+    }
+
+    /* Free entries are at the head, so this evicts only if there are none */
+    e = QTAILQ_FIRST(&c->lru_list);
+    i = e - c->entries;
+    qcow2_compressed_cache_unlink(c, i);
+
+    memcpy(c->data + (size_t)i * s->cluster_size, buf, s->cluster_size);
+    qcow2_compressed_cache_link(c, i, coffset);
+    QTAILQ_REMOVE(&c->lru_list, e, lru_entry);
+    QTAILQ_INSERT_TAIL(&c->lru_list, e, lru_entry);
+}
+
+/*
+ * Copy @bytes of compressed data at host offset @offset from the readahead
+ * buffer into @buf if it is covered by it.  Returns true on success.
+ */
+bool qcow2_compressed_cache_get_raw(BDRVQcow2State *s, uint64_t offset,
+                                    uint64_t bytes, void *buf)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    if (!c->ra_buf || offset < c->ra_offset ||
+        offset + bytes > c->ra_offset + c->ra_bytes) {
+        return false;
+    }
+    memcpy(buf, c->ra_buf + (offset - c->ra_offset), bytes);
+    trace_qcow2_compressed_cache_readahead_hit(s, offset, bytes);
+    return true;
+}
+
+/*
+ * Make @buf (allocated with g_malloc()) the readahead buffer for the host
+ * range [@offset, @offset + @bytes).  Takes ownership of @buf.
+ */
+void qcow2_compressed_cache_put_raw(BDRVQcow2State *s, uint64_t offset,
+                                    void *buf, uint64_t bytes, uint64_t gen)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+
+    QEMU_LOCK_GUARD(&c->lock);
+    if (!c->size || c->generation != gen) {
+        g_free(buf);
+        return;
+    }
+    g_free(c->ra_buf);
+    c->ra_buf = buf;
+    c->ra_offset = offset;
+    c->ra_bytes = bytes;
+}
+
+/*
+ * Drop everything that was read from the host range [@offset, @offset +
+ * @bytes).  Called whenever the refcount of that range changes.
+ */
+void qcow2_compressed_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                       uint64_t bytes)
+{
+    Qcow2CompressedCache *c = &s->compressed_cache;
+    uint64_t end = bytes > UINT64_MAX - offset ? UINT64_MAX : offset + bytes;
+    IntervalTreeNode *node;
+
+    if (!qcow2_compressed_cache_enabled(s) || !bytes) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    c->generation++;
+    while ((node = interval_tree_iter_first(&c->tree, offset, end - 1))) {
+        Qcow2CompressedCacheEntry *e =
+            container_of(node, Qcow2CompressedCacheEntry, node);
+
+        qcow2_compressed_cache_unlink(c, e - c->entries);
+    }
+    if (c->ra_buf && c->ra_offset < end &&
+        offset < c->ra_offset + c->ra_bytes) {
+        g_free(c->ra_buf);
+        c->ra_buf = NULL;
+        c->ra_offset = 0;
+        c->ra_bytes = 0;
+    }
+}
@@ -828,6 +828,13 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         return 0;
     }
 
+    /*
+     * Compressed data read from this range may be freed or overwritten now.
+     * Compressed writes invalidate their range again once the data is on
+     * disk.
+     */
+    qcow2_compressed_cache_invalidate(s, offset, length);
+
     if (decrease) {
         qcow2_cache_set_dependency(bs, s->refcount_block_cache,
             s->l2_table_cache);
@@ -1028,6 +1035,86 @@ int64_t qcow2_alloc_clusters(BlockDriverState *bs, uint64_t size)
     return offset;
 }
 
+/*
+ * Takes up to @nb_clusters clusters from the start of the data cluster
+ * reservation if it begins at @offset. Returns the number of clusters taken.
+ */
+static uint64_t take_reserved_clusters(BDRVQcow2State *s, uint64_t offset,
+                                       uint64_t nb_clusters)
+{
+    uint64_t n;
+
+    if (s->nb_reserved_clusters == 0 || offset != s->reserved_offset) {
+        return 0;
+    }
+
+    n = MIN(nb_clusters, s->nb_reserved_clusters);
+    s->reserved_offset += n << s->cluster_bits;
+    s->nb_reserved_clusters -= n;
+
+    return n;
+}
+
+/*
+ * Allocates up to *nb_clusters contiguous clusters for guest data.
+ *
+ * If the alloc-reservation-size option is set, small allocations are served
+ * from a range of clusters that was allocated in advance, so that the
+ * refcount blocks only need to be updated once for many allocating writes.
+ * In this case *nb_clusters may be decreased; the caller can try to extend
+ * the allocation with qcow2_alloc_clusters_at().
+ *
+ * Returns the offset of the first allocated cluster or -errno.
+ */
+int64_t qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t offset;
+
+    if (*nb_clusters >= s->alloc_reservation_clusters) {
+        return qcow2_alloc_clusters(bs, *nb_clusters << s->cluster_bits);
+    }
+
+    if (s->nb_reserved_clusters == 0) {
+        offset = qcow2_alloc_clusters(bs, s->alloc_reservation_clusters <<
+                                          s->cluster_bits);
+        if (offset < 0) {
+            return offset;
+        }
+
+        trace_qcow2_reserve_clusters(qemu_coroutine_self(), offset,
+                                     s->alloc_reservation_clusters);
+        s->reserved_offset = offset;
+        s->nb_reserved_clusters = s->alloc_reservation_clusters;
+    }
+
+    offset = s->reserved_offset;
+    *nb_clusters = take_reserved_clusters(s, offset, *nb_clusters);
+
+    return offset;
+}
+
+/*
+ * Drops the refcount of all clusters in the data cluster reservation that
+ * have not been handed out yet. This must be done before anything that
+ * inspects or rebuilds the refcount structures, and before the image is
+ * closed, because the reserved clusters would be reported as leaked
+ * otherwise.
+ */
+void qcow2_release_reserved_clusters(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (s->nb_reserved_clusters == 0) {
+        return;
+    }
+
+    qcow2_free_clusters(bs, s->reserved_offset,
+                        s->nb_reserved_clusters << s->cluster_bits,
+                        QCOW2_DISCARD_NEVER);
+    s->nb_reserved_clusters = 0;
+}
+
 int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                                              int64_t nb_clusters)
 {
@@ -1041,6 +1128,12 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
         return 0;
     }
 
+    /* The clusters right after a reserved allocation are reserved as well */
+    i = take_reserved_clusters(s, offset, nb_clusters);
+    if (i > 0) {
+        return i;
+    }
+
     do {
         /* Check how many clusters there are free */
         cluster_index = offset >> s->cluster_bits;
@@ -614,6 +614,8 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    qcow2_release_reserved_clusters(bs);
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -701,6 +703,8 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_ALLOC_RESERVATION_SIZE,
+    QCOW2_OPT_COMPRESSED_CACHE_SIZE,
     NULL
 };
 
@@ -817,6 +821,16 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_ALLOC_RESERVATION_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Allocate clusters for guest data in chunks of this size",
+        },
+        {
+            .name = QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Maximum size of the decompressed cluster cache",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -979,6 +993,8 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t alloc_reservation_clusters;
+    int compressed_cache_clusters;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -991,6 +1007,7 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
     const char *opt_overlap_check, *opt_overlap_check_template;
     int overlap_check_template = 0;
     uint64_t l2_cache_size, l2_cache_entry_size, refcount_cache_size;
+    uint64_t alloc_reservation_size, compressed_cache_size;
     int i;
     const char *encryptfmt;
     QDict *encryptopts = NULL;
@@ -1032,6 +1049,29 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    alloc_reservation_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_ALLOC_RESERVATION_SIZE, 0);
+    if (alloc_reservation_size > INT_MAX) {
+        error_setg(errp, "Allocation reservation size too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->alloc_reservation_clusters =
+        size_to_clusters(s, alloc_reservation_size);
+
+    compressed_cache_size =
+        qemu_opt_get_size(opts, QCOW2_OPT_COMPRESSED_CACHE_SIZE,
+                          DEFAULT_COMPRESSED_CACHE_SIZE);
+    if (compressed_cache_size > INT_MAX) {
+        error_setg(errp, "Compressed cluster cache size too big");
+        ret = -EINVAL;
+        goto fail;
+    }
+    r->compressed_cache_clusters = compressed_cache_size / s->cluster_size;
+
+    /* Give back reserved clusters so that the new setting takes effect */
+    qcow2_release_reserved_clusters(bs);
+
     /* alloc new L2 table/refcount block cache, flush old one */
     if (s->l2_table_cache) {
         ret = qcow2_cache_flush(bs, s->l2_table_cache);
@@ -1238,6 +1278,14 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
     }
 
     s->discard_no_unref = r->discard_no_unref;
+    s->alloc_reservation_clusters = r->alloc_reservation_clusters;
+
+    if (s->compressed_cache.size != r->compressed_cache_clusters &&
+        qcow2_compressed_cache_resize(s, r->compressed_cache_clusters) < 0)
+    {
+        /* The cache is only an optimization, run without it */
+        qcow2_compressed_cache_resize(s, 0);
+    }
 
     if (s->cache_clean_interval != r->cache_clean_interval) {
         cache_clean_timer_del(bs);
@@ -1328,6 +1376,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     uint64_t l1_vm_state_index;
     bool update_header = false;
 
+    qcow2_compressed_cache_init(s);
+
     ret = bdrv_co_pread(bs->file, 0, sizeof(header), &header, 0);
     if (ret < 0) {
         error_setg_errno(errp, -ret, "Could not read qcow2 header");
@@ -1888,6 +1938,8 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
 #endif
 
     qemu_co_queue_init(&s->thread_task_queue);
+    s->max_threads = MIN(MAX(g_get_num_processors(), QCOW2_MIN_THREADS),
+                         QCOW2_MAX_THREADS);
 
     return ret;
 
@@ -1913,6 +1965,7 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     if (s->refcount_block_cache) {
         qcow2_cache_destroy(s->refcount_block_cache);
     }
+    qcow2_compressed_cache_destroy(s);
     qcrypto_block_free(s->crypto);
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     return ret;
@@ -2762,6 +2815,8 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
     int ret, result = 0;
     Error *local_err = NULL;
 
+    qcow2_release_reserved_clusters(bs);
+
     qcow2_store_persistent_dirty_bitmaps(bs, true, &local_err);
     if (local_err != NULL) {
         result = -EINVAL;
@@ -2806,6 +2861,7 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    qcow2_compressed_cache_destroy(s);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -4340,6 +4396,8 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
     old_length = bs->total_sectors * BDRV_SECTOR_SIZE;
     new_l1_size = size_to_l1(s, offset);
 
+    qcow2_release_reserved_clusters(bs);
+
     if (offset < old_length) {
         int64_t last_cluster, old_file_size;
         if (prealloc != PREALLOC_MODE_OFF) {
@@ -4724,6 +4782,13 @@ qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
 
     BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
     ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
+
+    /*
+     * A readahead that ran while the data was being written may have
+     * cached the old content of the range.  update_refcount() has already
+     * invalidated it, but that was before the write.
+     */
+    qcow2_compressed_cache_invalidate(s, cluster_offset, out_len);
     if (ret < 0) {
         goto fail;
     }
@@ -4818,6 +4883,55 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     return ret;
 }
 
+/*
+ * Read @csize bytes of compressed data at host offset @coffset into @buf.
+ * If the compressed cluster cache is enabled, read ahead so that the data
+ * of the following compressed clusters, which usually directly follows in
+ * the image file, can be served from memory.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+qcow2_co_read_compressed_data(BlockDriverState *bs, uint64_t coffset,
+                              int csize, uint8_t *buf, uint64_t gen)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int64_t file_length, ra_bytes;
+    uint8_t *ra_buf;
+    int ret;
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
+
+    if (!qcow2_compressed_cache_enabled(s)) {
+        return bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    }
+
+    file_length = bdrv_co_getlength(bs->file->bs);
+    ra_bytes = MAX(QCOW2_COMPRESSED_READAHEAD_SIZE, 2 * s->cluster_size);
+    if (file_length > 0 && coffset < file_length) {
+        ra_bytes = MIN(ra_bytes, file_length - coffset);
+    } else {
+        ra_bytes = 0;
+    }
+    if (ra_bytes <= csize) {
+        return bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    }
+
+    ra_buf = g_try_malloc(ra_bytes);
+    if (!ra_buf) {
+        return bdrv_co_pread(bs->file, coffset, csize, buf, 0);
+    }
+
+    trace_qcow2_compressed_readahead(qemu_coroutine_self(), coffset, ra_bytes);
+    ret = bdrv_co_pread(bs->file, coffset, ra_bytes, ra_buf, 0);
+    if (ret < 0) {
+        g_free(ra_buf);
+        return ret;
+    }
+
+    memcpy(buf, ra_buf, csize);
+    qcow2_compressed_cache_put_raw(s, coffset, ra_buf, ra_bytes, gen);
+    return 0;
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_preadv_compressed(BlockDriverState *bs,
                            uint64_t l2_entry,
@@ -4828,23 +4942,29 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     int ret = 0, csize;
-    uint64_t coffset;
-    uint8_t *buf, *out_buf;
+    uint64_t coffset, gen;
+    uint8_t *buf = NULL, *out_buf;
     int offset_in_cluster = offset_into_cluster(s, offset);
 
     qcow2_parse_compressed_l2_entry(bs, l2_entry, &coffset, &csize);
 
+    out_buf = qemu_blockalign(bs, s->cluster_size);
+
+    if (qcow2_compressed_cache_get(s, coffset, out_buf, &gen)) {
+        goto out;
+    }
+
     buf = g_try_malloc(csize);
     if (!buf) {
-        return -ENOMEM;
+        ret = -ENOMEM;
+        goto fail;
     }
 
-    out_buf = qemu_blockalign(bs, s->cluster_size);
-
-    BLKDBG_CO_EVENT(bs->file, BLKDBG_READ_COMPRESSED);
-    ret = bdrv_co_pread(bs->file, coffset, csize, buf, 0);
-    if (ret < 0) {
-        goto fail;
+    if (!qcow2_compressed_cache_get_raw(s, coffset, csize, buf)) {
+        ret = qcow2_co_read_compressed_data(bs, coffset, csize, buf, gen);
+        if (ret < 0) {
+            goto fail;
+        }
     }
 
     if (qcow2_co_decompress(bs, out_buf, s->cluster_size, buf, csize) < 0) {
@@ -4852,6 +4972,9 @@ qcow2_co_preadv_compressed(BlockDriverState *bs,
         goto fail;
     }
 
+    qcow2_compressed_cache_put(s, coffset, out_buf, gen);
+
+out:
     qemu_iovec_from_buf(qiov, qiov_offset, out_buf + offset_in_cluster, bytes);
 
 fail:
@@ -4885,6 +5008,8 @@ static int GRAPH_RDLOCK make_completely_empty(BlockDriverState *bs)
         goto fail;
     }
 
+    qcow2_compressed_cache_invalidate(s, 0, UINT64_MAX);
+
     /* Refcounts will be broken utterly */
     ret = qcow2_mark_dirty(bs);
     if (ret < 0) {
@@ -5021,6 +5146,8 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
 
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
+    qcow2_release_reserved_clusters(bs);
+
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
         3 + l1_clusters <= s->refcount_block_size &&
         s->crypt_method_header != QCOW_CRYPT_LUKS &&
@@ -5700,6 +5827,8 @@ qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
     Qcow2AmendHelperCBInfo helper_cb_info;
     bool encryption_update = false;
 
+    qcow2_release_reserved_clusters(bs);
+
     while (desc && desc->name) {
         if (!qemu_opt_find(opts, desc->name)) {
             /* only change explicitly defined options */
@@ -28,6 +28,7 @@
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
 #include "qemu/units.h"
+#include "qemu/interval-tree.h"
 #include "block/block_int.h"
 
 //#define DEBUG_ALLOC
@@ -128,6 +129,15 @@
 
 #define DEFAULT_CLUSTER_SIZE 65536
 
+/* Decompressed clusters cached per image, see qcow2-compressed-cache.c */
+#define DEFAULT_COMPRESSED_CACHE_SIZE 0
+
+/*
+ * Compressed data read in one request on a cache miss, so that the data of
+ * clusters that were compressed one after another is already in memory.
+ */
+#define QCOW2_COMPRESSED_READAHEAD_SIZE (256 * KiB)
+
 #define QCOW2_OPT_DATA_FILE "data-file"
 #define QCOW2_OPT_LAZY_REFCOUNTS "lazy-refcounts"
 #define QCOW2_OPT_DISCARD_REQUEST "pass-discard-request"
@@ -150,6 +160,8 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_ALLOC_RESERVATION_SIZE "alloc-reservation-size"
+#define QCOW2_OPT_COMPRESSED_CACHE_SIZE "compressed-cache-size"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -231,6 +243,31 @@ typedef struct QCowSnapshot {
 struct Qcow2Cache;
 typedef struct Qcow2Cache Qcow2Cache;
 
+typedef struct Qcow2CompressedCacheEntry Qcow2CompressedCacheEntry;
+
+typedef struct Qcow2CompressedCache {
+    QemuMutex lock;
+    int size;                   /* Number of clusters, 0 if disabled */
+    Qcow2CompressedCacheEntry *entries;
+    uint8_t *data;              /* Decompressed clusters */
+    uint64_t generation;        /* Incremented on every invalidation */
+
+    /* Hash index from compressed data offset to entry index */
+    int *hash_buckets;
+    unsigned hash_mask;
+
+    /* Entries in use, ordered by offset for range invalidation */
+    IntervalTreeRoot tree;
+
+    /* All entries, least recently used first, free entries at the head */
+    QTAILQ_HEAD(, Qcow2CompressedCacheEntry) lru_list;
+
+    /* Compressed data read ahead on the last miss */
+    uint8_t *ra_buf;
+    uint64_t ra_offset;
+    uint64_t ra_bytes;
+} Qcow2CompressedCache;
+
 typedef struct Qcow2CryptoHeaderExtension {
     uint64_t offset;
     uint64_t length;
@@ -322,7 +359,12 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Compression and encryption are offloaded to the thread pool with up to one
+ * request in flight per host CPU, but no fewer than QCOW2_MIN_THREADS.
+ */
+#define QCOW2_MIN_THREADS 4
+#define QCOW2_MAX_THREADS 64
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -357,6 +399,16 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Data clusters that already have a refcount of 1 but are not referenced
+     * by any L2 entry yet, see qcow2_alloc_data_clusters()
+     */
+    uint64_t alloc_reservation_clusters; /* Refill size, 0 if disabled */
+    uint64_t reserved_offset;
+    uint64_t nb_reserved_clusters;
+
+    Qcow2CompressedCache compressed_cache;
+
     CoMutex lock;
 
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
@@ -410,6 +462,7 @@ typedef struct BDRVQcow2State {
 
     CoQueue thread_task_queue;
     int nb_threads;
+    int max_threads;
 
     BdrvChild *data_file;
 
@@ -873,6 +926,11 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int64_t GRAPH_RDLOCK
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t *nb_clusters);
+
+void GRAPH_RDLOCK qcow2_release_reserved_clusters(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -1022,6 +1080,22 @@ void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
 
+/* qcow2-compressed-cache.c functions */
+void qcow2_compressed_cache_init(BDRVQcow2State *s);
+void qcow2_compressed_cache_destroy(BDRVQcow2State *s);
+int qcow2_compressed_cache_resize(BDRVQcow2State *s, int num_clusters);
+bool qcow2_compressed_cache_enabled(BDRVQcow2State *s);
+bool qcow2_compressed_cache_get(BDRVQcow2State *s, uint64_t coffset,
+                                void *buf, uint64_t *gen);
+void qcow2_compressed_cache_put(BDRVQcow2State *s, uint64_t coffset,
+                                const void *buf, uint64_t gen);
+bool qcow2_compressed_cache_get_raw(BDRVQcow2State *s, uint64_t offset,
+                                    uint64_t bytes, void *buf);
+void qcow2_compressed_cache_put_raw(BDRVQcow2State *s, uint64_t offset,
+                                    void *buf, uint64_t bytes, uint64_t gen);
+void qcow2_compressed_cache_invalidate(BDRVQcow2State *s, uint64_t offset,
+                                       uint64_t bytes);
+
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
 qcow2_check_bitmaps_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
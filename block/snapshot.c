@@ -255,6 +255,7 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
     if (drv->bdrv_snapshot_goto) {
         ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
         if (ret < 0) {
             error_setg_errno(errp, -ret, "Failed to load snapshot");
         }
@@ -450,6 +451,7 @@ int bdrv_snapshot_load_tmp(BlockDriverState *bs,
         return -EINVAL;
     }
     if (drv->bdrv_snapshot_load_tmp) {
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
         return drv->bdrv_snapshot_load_tmp(bs, snapshot_id, name, errp);
     }
     error_setg(errp, "Block format '%s' used by device '%s' "
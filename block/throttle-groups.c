@@ -62,6 +62,12 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * A group can have a parent group (e.g. one group per disk and a
+ * parent group per tenant). I/O in the child group is then subject to
+ * the limits of all its ancestors as well, and is accounted in all of
+ * them. The lock of a group is always taken before the lock of its
+ * parent.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -76,6 +82,14 @@ struct ThrottleGroup {
     ThrottleGroupMember *tokens[THROTTLE_MAX];
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
+    /* The time at which child groups can do I/O again, see
+     * throttle_group_compute_timer(). Also protected by this lock. */
+    int64_t next_timestamp[THROTTLE_MAX];
+
+    /* These are constant once initialization is complete */
+    char *parent_name;
+    ThrottleGroup *parent;
+    bool borrow;
 
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
@@ -254,6 +268,91 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Compute whether I/O in a ThrottleGroup has to wait, taking the limits
+ * of all its ancestors into account.
+ *
+ * If the parent group is out of credit, all its children wait until the
+ * same timestamp so their timers expire together instead of causing a
+ * separate wakeup each. If the parent has unused credit, children with
+ * the 'borrow' property set can exceed their own limits. A parent
+ * without limits in @direction has no credit to lend.
+ *
+ * This assumes that tg->lock is held. The locks of the ancestors are
+ * taken here.
+ *
+ * @tg:             the ThrottleGroup
+ * @direction:      the ThrottleDirection
+ * @now:            the current clock timestamp
+ * @next_timestamp: the resulting timer
+ * @ret:            true if a timer must be set
+ */
+static bool throttle_group_compute_timer(ThrottleGroup *tg,
+                                         ThrottleDirection direction,
+                                         int64_t now,
+                                         int64_t *next_timestamp)
+{
+    ThrottleGroup *parent = tg->parent;
+    int64_t wait = throttle_compute_wait_at(&tg->ts, direction, now);
+    bool borrow = false;
+
+    if (parent) {
+        int64_t *parent_next = &parent->next_timestamp[direction];
+
+        qemu_mutex_lock(&parent->lock);
+        if (now < *parent_next ||
+            throttle_group_compute_timer(parent, direction, now,
+                                         parent_next)) {
+            *next_timestamp = *parent_next;
+            qemu_mutex_unlock(&parent->lock);
+            return true;
+        }
+        borrow = tg->borrow && throttle_has_headroom(&parent->ts, direction);
+        qemu_mutex_unlock(&parent->lock);
+    }
+
+    if (wait && !borrow) {
+        *next_timestamp = now + wait;
+        return true;
+    }
+
+    *next_timestamp = now;
+    return false;
+}
+
+/* Account an I/O request in a ThrottleGroup and all its ancestors.
+ *
+ * A child group that is over its own limits can only be doing I/O
+ * because it is borrowing credit from its parent, so in that case the
+ * request is only accounted in the parent.
+ *
+ * This assumes that tg->lock is held. The locks of the ancestors are
+ * taken here.
+ *
+ * @tg:        the ThrottleGroup
+ * @direction: the ThrottleDirection
+ * @bytes:     the number of bytes for this I/O
+ */
+static void throttle_group_account(ThrottleGroup *tg,
+                                   ThrottleDirection direction,
+                                   int64_t bytes)
+{
+    ThrottleGroup *parent = tg->parent;
+
+    if (!tg->borrow || !parent ||
+        !throttle_compute_wait_at(&tg->ts, direction,
+                                  qemu_clock_get_ns(tg->clock_type))) {
+        throttle_account(&tg->ts, direction, bytes);
+    }
+
+    if (parent) {
+        qemu_mutex_lock(&parent->lock);
+        throttle_group_account(parent, direction, bytes);
+        /* The accounting may have pushed the deadline further */
+        parent->next_timestamp[direction] = 0;
+        qemu_mutex_unlock(&parent->lock);
+    }
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
  * throttled or not. If there's no timer set in this group, set one and update
  * the token accordingly.
@@ -270,7 +369,8 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     ThrottleTimers *tt = &tgm->throttle_timers;
-    bool must_wait;
+    QEMUTimer *timer = tt->timers[direction];
+    int64_t next_timestamp;
 
     if (qatomic_read(&tgm->io_limits_disabled)) {
         return false;
@@ -281,15 +381,21 @@ static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
         return true;
     }
 
-    must_wait = throttle_schedule_timer(ts, tt, direction);
+    if (!throttle_group_compute_timer(tg, direction,
+                                      qemu_clock_get_ns(tt->clock_type),
+                                      &next_timestamp)) {
+        return false;
+    }
 
-    /* If a timer just got armed, set tgm as the current token */
-    if (must_wait) {
-        tg->tokens[direction] = tgm;
-        tg->any_timer_armed[direction] = true;
+    if (!timer_pending(timer)) {
+        timer_mod(timer, next_timestamp);
     }
 
-    return must_wait;
+    /* A timer just got armed, set tgm as the current token */
+    tg->tokens[direction] = tgm;
+    tg->any_timer_armed[direction] = true;
+
+    return true;
 }
 
 /* Start the next pending I/O request for a ThrottleGroupMember. Return whether
@@ -388,7 +494,7 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     }
 
     /* The I/O will be executed, so do the accounting */
-    throttle_account(tgm->throttle_state, direction, bytes);
+    throttle_group_account(tg, direction, bytes);
 
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
@@ -465,6 +571,25 @@ void throttle_group_restart_tgm(ThrottleGroupMember *tgm)
     }
 }
 
+/* Apply a new throttle configuration to a ThrottleGroup. The deadline
+ * that child groups share was computed with the old limits, so it is
+ * dropped as well.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tg:  the ThrottleGroup
+ * @cfg: the configuration to set
+ */
+static void throttle_group_do_config(ThrottleGroup *tg, ThrottleConfig *cfg)
+{
+    ThrottleDirection dir;
+
+    throttle_config(&tg->ts, tg->clock_type, cfg);
+    for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+        tg->next_timestamp[dir] = 0;
+    }
+}
+
 /* Update the throttle configuration for a particular group. Similar
  * to throttle_config(), but guarantees atomicity within the
  * throttling group.
@@ -477,7 +602,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
-    throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_do_config(tg, cfg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -771,6 +896,7 @@ static void throttle_group_obj_init(Object *obj)
 static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
 {
     ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *parent = NULL;
     ThrottleConfig cfg;
 
     /* set group name to object id if it exists */
@@ -791,7 +917,32 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
     if (!throttle_is_valid(&cfg, errp)) {
         return;
     }
+
+    /* The parent must exist already, so there can be no cycles */
+    if (tg->parent_name) {
+        parent = throttle_group_by_name(tg->parent_name);
+        if (!parent) {
+            error_setg(errp, "Throttle group '%s' not found",
+                       tg->parent_name);
+            return;
+        }
+    } else if (tg->borrow) {
+        error_setg(errp, "'borrow' requires a parent group");
+        return;
+    }
+
+    /* Without limits in the parent there is no credit to borrow */
+    if (tg->borrow && !throttle_enabled(&parent->ts.cfg)) {
+        error_setg(errp, "'borrow' requires limits in parent group '%s'",
+                   tg->parent_name);
+        return;
+    }
+    if (parent) {
+        object_ref(OBJECT(parent));
+    }
+
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    tg->parent = parent;
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
 }
@@ -804,7 +955,11 @@ static void throttle_group_obj_finalize(Object *obj)
     if (tg->is_initialized) {
         QTAILQ_REMOVE(&throttle_groups, tg, list);
     }
+    if (tg->parent) {
+        object_unref(OBJECT(tg->parent));
+    }
     qemu_mutex_destroy(&tg->lock);
+    g_free(tg->parent_name);
     g_free(tg->name);
 }
 
@@ -902,7 +1057,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
     if (local_err) {
         goto unlock;
     }
-    throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_do_config(tg, &cfg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
@@ -929,6 +1084,44 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static char *throttle_group_get_parent_group(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    return g_strdup(tg->parent_name);
+}
+
+static void throttle_group_set_parent_group(Object *obj, const char *value,
+                                            Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+
+    g_free(tg->parent_name);
+    tg->parent_name = g_strdup(value);
+}
+
+static bool throttle_group_get_borrow(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    return tg->borrow;
+}
+
+static void throttle_group_set_borrow(Object *obj, bool value, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+
+    tg->borrow = value;
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -958,6 +1151,14 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_get_limits,
                               throttle_group_set_limits,
                               NULL, NULL);
+
+    /* Hierarchy */
+    object_class_property_add_str(klass, "parent-group",
+                                  throttle_group_get_parent_group,
+                                  throttle_group_set_parent_group);
+    object_class_property_add_bool(klass, "borrow",
+                                   throttle_group_get_borrow,
+                                   throttle_group_set_borrow);
 }
 
 static const TypeInfo throttle_group_info = {
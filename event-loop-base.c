@@ -27,6 +27,7 @@ static void event_loop_base_instance_init(Object *obj)
     EventLoopBase *base = EVENT_LOOP_BASE(obj);
 
     base->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
+    base->io_uring_sqpoll_cpu = -1;
 }
 
 static EventLoopBaseParamInfo aio_max_batch_info = {
@@ -38,6 +39,9 @@ static EventLoopBaseParamInfo thread_pool_min_info = {
 static EventLoopBaseParamInfo thread_pool_max_info = {
     "thread-pool-max", offsetof(EventLoopBase, thread_pool_max),
 };
+static EventLoopBaseParamInfo io_uring_sqpoll_cpu_info = {
+    "io-uring-sqpoll-cpu", offsetof(EventLoopBase, io_uring_sqpoll_cpu),
+};
 
 static void event_loop_base_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
@@ -77,6 +81,26 @@ static void event_loop_base_set_param(Object *obj, Visitor *v,
     return;
 }
 
+static bool event_loop_base_get_io_uring_sqpoll(Object *obj, Error **errp)
+{
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    return base->io_uring_sqpoll;
+}
+
+static void event_loop_base_set_io_uring_sqpoll(Object *obj, bool value,
+                                                Error **errp)
+{
+    EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(obj);
+    EventLoopBase *base = EVENT_LOOP_BASE(obj);
+
+    base->io_uring_sqpoll = value;
+
+    if (bc->update_params) {
+        bc->update_params(base, errp);
+    }
+}
+
 static void event_loop_base_complete(UserCreatable *uc, Error **errp)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_GET_CLASS(uc);
@@ -117,6 +141,13 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add_bool(klass, "io-uring-sqpoll",
+                                   event_loop_base_get_io_uring_sqpoll,
+                                   event_loop_base_set_io_uring_sqpoll);
+    object_class_property_add(klass, "io-uring-sqpoll-cpu", "int",
+                              event_loop_base_get_param,
+                              event_loop_base_set_param,
+                              NULL, &io_uring_sqpoll_cpu_info);
 }
 
 static const TypeInfo event_loop_base_info = {
@@ -27,6 +27,7 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-types-common.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
@@ -94,6 +95,32 @@ struct BlockAcctStats {
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
+/*
+ * Number of buckets in the per-node latency histograms.  Bucket 0 counts
+ * requests that took 0 nanoseconds and bucket i > 0 those that took
+ * [2^(i-1), 2^i) nanoseconds; the last bucket also holds everything slower
+ * than that.
+ */
+#define BLOCK_NODE_LATENCY_BUCKETS 40
+
+/*
+ * Lock-free request statistics kept for every BlockDriverState node,
+ * including format, protocol and filter nodes.  Updated from any thread
+ * that submits requests to the node.
+ */
+typedef struct BlockNodeOpStats {
+    Stat64 nr_ops;
+    Stat64 nr_bytes;
+    Stat64 failed_ops;
+    Stat64 total_time_ns;
+    unsigned int in_flight;
+    Stat64 latency_log2[BLOCK_NODE_LATENCY_BUCKETS];
+} BlockNodeOpStats;
+
+typedef struct BlockNodeStats {
+    BlockNodeOpStats op[BLOCK_MAX_IOTYPE];
+} BlockNodeStats;
+
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
@@ -121,4 +148,8 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
+int64_t block_node_stats_start(BlockNodeStats *stats, enum BlockAcctType type);
+void block_node_stats_done(BlockNodeStats *stats, enum BlockAcctType type,
+                           int64_t start_time_ns, int64_t bytes, int ret);
+
 #endif
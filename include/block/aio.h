@@ -25,6 +25,9 @@
 #include "block/graph-lock.h"
 #include "hw/qdev-core.h"
 
+/* Size and number of cached request padding buffers per AioContext */
+#define AIO_PADDING_BUF_SIZE (8 * 1024)
+#define AIO_PADDING_BUFS_MAX 16
 
 typedef struct BlockAIOCB BlockAIOCB;
 typedef void BlockCompletionFunc(void *opaque, int ret);
@@ -208,12 +211,24 @@ struct AioContext {
      */
     struct ThreadPool *thread_pool;
 
+    /*
+     * Free request padding buffers of AIO_PADDING_BUF_SIZE bytes, reused by
+     * block/io.c for unaligned requests instead of allocating a new buffer
+     * each time.  Only accessed from the home thread.
+     */
+    void *padding_bufs[AIO_PADDING_BUFS_MAX];
+    unsigned int nr_padding_bufs;
+
 #ifdef CONFIG_LINUX_AIO
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
 
+    /* Parameters for creating linux_io_uring */
+    bool linux_io_uring_sqpoll;
+    int linux_io_uring_sqpoll_cpu;  /* -1 for no CPU affinity */
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -720,4 +735,17 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp);
+
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @sqpoll: let a kernel thread poll the submission queue of the io_uring
+ *          instance used for block I/O
+ * @sqpoll_cpu: CPU to bind the submission queue polling thread to, or -1
+ *
+ * The parameters take effect when the io_uring instance is created, i.e.
+ * when the first request is submitted with aio=io_uring.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_cpu, Error **errp);
 #endif
@@ -24,10 +24,12 @@
 #ifndef BLOCK_INT_COMMON_H
 #define BLOCK_INT_COMMON_H
 
+#include "block/accounting.h"
 #include "block/aio.h"
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -1049,21 +1051,35 @@ struct BdrvChild {
 };
 
 /*
- * Allows bdrv_co_block_status() to cache one data region for a
- * protocol node.
+ * A region cached by BdrvBlockStatusCache.
  *
- * @valid: Whether the cache is valid (should be accessed with atomic
- *         functions so this can be reset by RCU readers)
- * @data_start: Offset where we know (or strongly assume) is data
- * @data_end: Offset where the data region ends (which is not necessarily
- *            the start of a zeroed region)
+ * @node: Interval tree node; [node.start, node.last] is the region
+ * @data: If true, this is a data region of a protocol node.  Otherwise,
+ *        it is a region that is not allocated in a node that supports
+ *        backing files.
  */
-typedef struct BdrvBlockStatusCache {
-    struct rcu_head rcu;
+typedef struct BdrvBlockStatusCacheEntry {
+    IntervalTreeNode node;
+    bool data;
+} BdrvBlockStatusCacheEntry;
 
-    bool valid;
-    int64_t data_start;
-    int64_t data_end;
+/*
+ * Allows bdrv_co_block_status() to cache the regions for which the
+ * driver reported data (protocol nodes) or no allocation (nodes that
+ * support backing files).
+ *
+ * @lock: Protects @tree and modifications of @nb_entries
+ * @tree: BdrvBlockStatusCacheEntry objects, which never overlap
+ * @nb_entries: Number of entries in @tree (can be read atomically
+ *              without holding @lock)
+ * @generation: Incremented before every invalidation, so that results
+ *              which raced with a write are not put into the cache
+ */
+typedef struct BdrvBlockStatusCache {
+    QemuMutex lock;
+    IntervalTreeRoot tree;
+    unsigned int nb_entries;
+    unsigned int generation;
 } BdrvBlockStatusCache;
 
 struct BlockDriverState {
@@ -1227,6 +1243,9 @@ struct BlockDriverState {
     unsigned int in_flight;
     unsigned int serialising_in_flight;
 
+    /* Per-node request statistics for query-stats.  Lock-free.  */
+    BlockNodeStats node_stats;
+
     /* do we need to tell the quest if we have a volatile write cache? */
     int enable_write_cache;
 
@@ -1247,10 +1266,8 @@ struct BlockDriverState {
     /* BdrvChild links to this node may never be frozen */
     bool never_freeze;
 
-    /* Lock for block-status cache RCU writers */
-    CoMutex bsc_modify_lock;
-    /* Always non-NULL, but must only be dereferenced under an RCU read guard */
-    BdrvBlockStatusCache *block_status_cache;
+    /* Accessed through the bdrv_bsc_*() functions only */
+    BdrvBlockStatusCache block_status_cache;
 
     /* array of write pointers' location of each zone in the zoned device. */
     BlockZoneWps *wps;
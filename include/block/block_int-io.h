@@ -166,29 +166,54 @@ bdrv_primary_bs(BlockDriverState *bs)
 }
 
 /**
- * Check whether the given offset is in the cached block-status data
+ * Check whether the given offset is in a cached block-status data
  * region.
  *
- * If it is, and @pnum is not NULL, *pnum is set to
- * `bsc.data_end - offset`, i.e. how many bytes, starting from
- * @offset, are data (according to the cache).
+ * If it is, and @pnum is not NULL, *pnum is set to how many bytes,
+ * starting from @offset, are data (according to the cache).
  * Otherwise, *pnum is not touched.
  */
 bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset, int64_t *pnum);
 
 /**
- * If [offset, offset + bytes) overlaps with the currently cached
- * block-status region, invalidate the cache.
+ * Check whether the given offset is in a cached region that is not
+ * allocated in @bs.
+ *
+ * If it is, and @pnum is not NULL, *pnum is set to how many bytes,
+ * starting from @offset, are unallocated (according to the cache).
+ * Otherwise, *pnum is not touched.
+ */
+bool bdrv_bsc_is_unallocated(BlockDriverState *bs, int64_t offset,
+                             int64_t *pnum);
+
+/**
+ * Drop all cached block-status regions that overlap with
+ * [offset, offset + bytes).
  *
  * (To be used by I/O paths that cause data regions to be zero or
- * holes.)
+ * holes, or that may allocate.  Pass INT64_MAX as @bytes to cover
+ * everything from @offset on.)
  */
 void bdrv_bsc_invalidate_range(BlockDriverState *bs,
                                int64_t offset, int64_t bytes);
 
+/**
+ * Return the current generation of the block-status cache, to be
+ * passed to bdrv_bsc_fill_unallocated() after querying the driver.
+ */
+unsigned int bdrv_bsc_generation(BlockDriverState *bs);
+
 /**
  * Mark the range [offset, offset + bytes) as a data region.
  */
 void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+/**
+ * Mark the range [offset, offset + bytes) as not allocated, unless
+ * the cache has been invalidated since @generation was returned by
+ * bdrv_bsc_generation().
+ */
+void bdrv_bsc_fill_unallocated(BlockDriverState *bs, int64_t offset,
+                               int64_t bytes, unsigned int generation);
+
 #endif /* BLOCK_INT_IO_H */
@@ -29,6 +29,12 @@ typedef struct BlockExportDriver {
      */
     size_t instance_size;
 
+    /*
+     * True if the driver spreads request processing over the AioContexts in
+     * BlockExport.iothread_ctxs (BlockExportOptions.iothreads)
+     */
+    bool supports_iothreads;
+
     /* Creates and starts a new block export */
     int (*create)(BlockExport *, BlockExportOptions *, Error **);
 
@@ -76,6 +82,17 @@ struct BlockExport {
     /* The block device to export */
     BlockBackend *blk;
 
+    /*
+     * The AioContexts of the iothreads in BlockExportOptions.iothreads, in
+     * the same order.  Drivers with supports_iothreads spread request
+     * processing over them.  Set before .create() is called.
+     */
+    AioContext **iothread_ctxs;
+    size_t num_iothread_ctxs;
+
+    /* References to the iothreads that iothread_ctxs belong to */
+    struct IOThread **iothreads;
+
     /* List entry for block_exports */
     QLIST_ENTRY(BlockExport) next;
 };
@@ -66,12 +66,23 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(bool sqpoll, int sqpoll_cpu, Error **errp);
 void luring_cleanup(LuringState *s);
 
 /* luring_co_submit: submit I/O requests in the thread's current AioContext. */
 int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+
+/*
+ * luring_co_submit_fixed: like luring_co_submit(), but refer to the file by
+ * an index returned by luring_register_file() for the io_uring instance of
+ * the thread's current AioContext.
+ */
+int coroutine_fn luring_co_submit_fixed(BlockDriverState *bs, int index,
+                                        uint64_t offset, QEMUIOVector *qiov,
+                                        int type);
+int luring_register_file(LuringState *s, int fd);
+void luring_unregister_file(LuringState *s, int index);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
@@ -44,8 +44,8 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 }
 
 /**
- * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * clear_bmap_set: set clear bitmap for the page range.  Can be called
+ * concurrently for different ranges of the same RAMBlock.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -58,12 +58,15 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
  * clear_bmap_test_and_clear: test clear bitmap for the page, clear if set.
- * Must be with bitmap_mutex held.
+ * Must be with bitmap_mutex held.  With the multifd parallel scan, the
+ * migration thread holds it while several channels call this for separate
+ * chunks, which may share a word of the clear bitmap; hence the atomic.
  *
  * @rb: the ramblock to operate on
  * @page: the page number to check
@@ -74,7 +77,7 @@ static inline bool clear_bmap_test_and_clear(RAMBlock *rb, uint64_t page)
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    return bitmap_test_and_clear(rb->clear_bmap, page >> shift, 1);
+    return bitmap_test_and_clear_atomic(rb->clear_bmap, page >> shift, 1);
 }
 
 static inline bool offset_in_ramblock(RAMBlock *b, ram_addr_t offset)
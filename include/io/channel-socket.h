@@ -262,4 +262,34 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to enable zero copy writes (QIO_CHANNEL_WRITE_FLAG_ZERO_COPY)
+ * on a connected socket. This is done automatically for sockets
+ * connected with qio_channel_socket_connect_sync(), but not for
+ * accepted ones.
+ *
+ * Returns: true if the channel now supports
+ * QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY, false otherwise
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+/**
+ * qio_channel_socket_zero_copy_poll:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Process the notifications for zero copy writes that have
+ * completed so far without blocking, updating
+ * @ioc->zero_copy_sent. Unlike qio_channel_flush(), this does
+ * not wait for outstanding writes, so it can be used to find
+ * out which buffers may be reused from an event loop.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
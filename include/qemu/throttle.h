@@ -158,6 +158,13 @@ bool throttle_schedule_timer(ThrottleState *ts,
 
 void throttle_account(ThrottleState *ts, ThrottleDirection direction,
                       uint64_t size);
+
+int64_t throttle_compute_wait_at(ThrottleState *ts,
+                                 ThrottleDirection direction,
+                                 int64_t now);
+
+bool throttle_has_headroom(ThrottleState *ts, ThrottleDirection direction);
+
 void throttle_limits_to_config(ThrottleLimits *arg, ThrottleConfig *cfg,
                                Error **errp);
 void throttle_config_to_limits(ThrottleConfig *cfg, ThrottleLimits *var);
@@ -32,6 +32,8 @@ struct EventLoopBase {
 
     /* AioContext AIO engine parameters */
     int64_t aio_max_batch;
+    bool io_uring_sqpoll;
+    int64_t io_uring_sqpoll_cpu;
 
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
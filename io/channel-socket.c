@@ -164,20 +164,28 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
+    qio_channel_socket_enable_zero_copy(ioc);
+
+    qio_channel_set_feature(QIO_CHANNEL(ioc),
+                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
+
+    return 0;
+}
+
+
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
 #ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
         /* Zero copy available on host */
         qio_channel_set_feature(QIO_CHANNEL(ioc),
                                 QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        return true;
     }
 #endif
-
-    qio_channel_set_feature(QIO_CHANNEL(ioc),
-                            QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
-
-    return 0;
+    return false;
 }
 
 
@@ -725,10 +733,17 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 
 
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+/*
+ * Process zero copy completion notifications from the error queue until
+ * all queued sends have completed or, if @block is false, until no more
+ * notifications are available.
+ *
+ * Returns -1 on error, 1 if the kernel had to copy the data for all
+ * completed sends and 0 otherwise.
+ */
+static int qio_channel_socket_zero_copy_reap(QIOChannelSocket *sioc,
+                                             bool block, Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -736,10 +751,6 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     int received;
     int ret;
 
-    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
-        return 0;
-    }
-
     msg.msg_control = control;
     msg.msg_controllen = sizeof(control);
     memset(control, 0, sizeof(control));
@@ -751,8 +762,11 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!block) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
-                qio_channel_wait(ioc, G_IO_ERR);
+                qio_channel_wait(QIO_CHANNEL(sioc), G_IO_ERR);
                 continue;
             case EINTR:
                 continue;
@@ -800,8 +814,30 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+
+    if (sioc->zero_copy_queued == sioc->zero_copy_sent) {
+        return 0;
+    }
+
+    return qio_channel_socket_zero_copy_reap(sioc, true, errp);
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
+int qio_channel_socket_zero_copy_poll(QIOChannelSocket *ioc, Error **errp)
+{
+#ifdef QEMU_MSG_ZEROCOPY
+    if (qio_channel_socket_zero_copy_reap(ioc, false, errp) < 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
 static int
 qio_channel_socket_set_blocking(QIOChannel *ioc,
                                 bool enabled,
@@ -109,6 +109,13 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                        info->ram->normal_bytes >> 10);
         monitor_printf(mon, "dirty sync count: %" PRIu64 "\n",
                        info->ram->dirty_sync_count);
+        if (info->ram->dirty_sync_time) {
+            monitor_printf(mon, "dirty sync time: %" PRIu64 " us "
+                           "(log %" PRIu64 " us, bitmap %" PRIu64 " us)\n",
+                           info->ram->dirty_sync_time,
+                           info->ram->dirty_sync_log_time,
+                           info->ram->dirty_sync_bitmap_time);
+        }
         monitor_printf(mon, "page size: %" PRIu64 " kbytes\n",
                        info->ram->page_size >> 10);
         monitor_printf(mon, "multifd bytes: %" PRIu64 " kbytes\n",
@@ -358,6 +365,26 @@ void hmp_info_migrate_parameters(Monitor *mon, const QDict *qdict)
                                MIGRATION_PARAMETER_DIRECT_IO),
                            params->direct_io ? "on" : "off");
         }
+
+        assert(params->has_dirty_sync_threads);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_DIRTY_SYNC_THREADS),
+            params->dirty_sync_threads);
+
+        assert(params->has_multifd_parallel_scan);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_MULTIFD_PARALLEL_SCAN),
+            params->multifd_parallel_scan ? "on" : "off");
+
+        assert(params->has_postcopy_prefetch_pages);
+        monitor_printf(mon, "%s: %u\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES),
+            params->postcopy_prefetch_pages);
+
+        assert(params->has_skip_unpopulated_ram);
+        monitor_printf(mon, "%s: %s\n",
+            MigrationParameter_str(MIGRATION_PARAMETER_SKIP_UNPOPULATED_RAM),
+            params->skip_unpopulated_ram ? "on" : "off");
     }
 
     qapi_free_MigrationParameters(params);
@@ -635,6 +662,22 @@ void hmp_migrate_set_parameter(Monitor *mon, const QDict *qdict)
         p->has_direct_io = true;
         visit_type_bool(v, param, &p->direct_io, &err);
         break;
+    case MIGRATION_PARAMETER_DIRTY_SYNC_THREADS:
+        p->has_dirty_sync_threads = true;
+        visit_type_uint8(v, param, &p->dirty_sync_threads, &err);
+        break;
+    case MIGRATION_PARAMETER_MULTIFD_PARALLEL_SCAN:
+        p->has_multifd_parallel_scan = true;
+        visit_type_bool(v, param, &p->multifd_parallel_scan, &err);
+        break;
+    case MIGRATION_PARAMETER_POSTCOPY_PREFETCH_PAGES:
+        p->has_postcopy_prefetch_pages = true;
+        visit_type_uint8(v, param, &p->postcopy_prefetch_pages, &err);
+        break;
+    case MIGRATION_PARAMETER_SKIP_UNPOPULATED_RAM:
+        p->has_skip_unpopulated_ram = true;
+        visit_type_bool(v, param, &p->skip_unpopulated_ram, &err);
+        break;
     default:
         assert(0);
     }
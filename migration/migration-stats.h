@@ -55,6 +55,13 @@ typedef struct {
      * copy.
      */
     Stat64 dirty_sync_missed_zero_copy;
+    /*
+     * Time in microseconds taken by the last synchronization of guest
+     * bitmaps, in total and for its stages.
+     */
+    Stat64 dirty_sync_time;
+    Stat64 dirty_sync_log_time;
+    Stat64 dirty_sync_bitmap_time;
     /*
      * Number of bytes sent at migration completion stage while the
      * guest is stopped.
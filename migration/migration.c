@@ -448,17 +448,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return qemu_fflush(mis->to_src_file);
 }
 
-/* Request one page from the source VM at the given start address.
+/* Request pages from the source VM at the given start address.
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -518,7 +518,67 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
+}
+
+/*
+ * Request @npages host pages starting at @start in @rb before the guest
+ * faults on them.  Pages that were already received or requested are
+ * skipped, and each run of the remaining ones is requested with a single
+ * message.  The pages are tracked like the faulted ones, so they are
+ * requested again after a postcopy recovery and waited for before the
+ * preempt channel is shut down.
+ */
+int migrate_send_rp_prefetch_pages(MigrationIncomingState *mis,
+                                   RAMBlock *rb, ram_addr_t start,
+                                   unsigned int npages)
+{
+    size_t page_size = qemu_ram_pagesize(rb);
+    size_t max_run = UINT32_MAX / page_size;
+    ram_addr_t run = start;
+    size_t run_pages = 0;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i <= npages; i++) {
+        ram_addr_t offset = start + (ram_addr_t)i * page_size;
+        void *host = qemu_ram_get_host_addr(rb) + offset;
+        bool wanted = false;
+
+        if (i < npages && !ramblock_page_is_discarded(rb, offset)) {
+            WITH_QEMU_LOCK_GUARD(&mis->page_request_mutex) {
+                wanted = !ramblock_recv_bitmap_test_byte_offset(rb, offset) &&
+                         !g_tree_lookup(mis->page_requested, host);
+                if (wanted) {
+                    g_tree_insert(mis->page_requested, host, (gpointer)1);
+                    qatomic_inc(&mis->page_requested_count);
+                    trace_postcopy_page_req_add(host,
+                                                mis->page_requested_count);
+                }
+            }
+        }
+
+        if (run_pages && (!wanted || run_pages == max_run)) {
+            trace_migrate_send_rp_prefetch_pages(qemu_ram_get_idstr(rb), run,
+                                                 run_pages);
+            ret = migrate_send_rp_message_req_pages(mis, rb, run,
+                                                    run_pages * page_size);
+            if (ret) {
+                return ret;
+            }
+            run_pages = 0;
+        }
+
+        if (wanted) {
+            if (!run_pages) {
+                run = offset;
+            }
+            run_pages++;
+        }
+    }
+
+    return 0;
 }
 
 static bool migration_colo_enabled;
@@ -1199,6 +1259,11 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_time = stat64_get(&mig_stats.dirty_sync_time);
+    info->ram->dirty_sync_log_time =
+        stat64_get(&mig_stats.dirty_sync_log_time);
+    info->ram->dirty_sync_bitmap_time =
+        stat64_get(&mig_stats.dirty_sync_bitmap_time);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
@@ -196,8 +196,8 @@ struct MigrationIncomingState {
     /* A tree of pages that we requested to the source VM */
     GTree *page_requested;
     /*
-     * For postcopy only, count the number of requested page faults that
-     * still haven't been resolved.
+     * For postcopy only, count the number of requested page faults (or
+     * prefetched pages) that still haven't been resolved.
      */
     int page_requested_count;
     /*
@@ -495,7 +495,11 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
+int migrate_send_rp_prefetch_pages(MigrationIncomingState *mis,
+                                   RAMBlock *rb, ram_addr_t start,
+                                   unsigned int npages);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
@@ -0,0 +1,429 @@
+/*
+ * Multifd XBZRLE delta compression implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The sending side keeps a copy of the pages it sent in a page cache.
+ * When a page is found there, the XBZRLE delta between the copy and the
+ * current contents is sent instead of the page, and the destination
+ * applies it to the page it already has.
+ *
+ * A page is not always sent through the same channel, so the cache is
+ * shared by all of them.  It is split into shards with their own lock,
+ * each covering interleaved ranges of RAM addresses.  The destination
+ * can only apply the delta to the right contents because multifd never
+ * has two versions of the same page in flight: each page is sent at most
+ * once per round over the dirty bitmap, and rounds are separated by a
+ * multifd sync.
+ *
+ * The payload of a packet is one big-endian 32-bit length per normal
+ * page, followed by the data of each page.  A length of page_size means
+ * the page is sent as is, a smaller one is XBZRLE-encoded data.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/host-utils.h"
+#include "qemu/bswap.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "trace.h"
+#include "options.h"
+#include "multifd.h"
+#include "page_cache.h"
+#include "xbzrle.h"
+
+typedef struct {
+    QemuMutex lock;
+    PageCache *cache;
+} XbzrleCacheShard;
+
+/*
+ * Shared by the send channels.  Only set up and torn down by the
+ * migration thread, in the send_setup and send_cleanup hooks.
+ */
+static struct {
+    XbzrleCacheShard *shards;
+    unsigned int num_shards;
+    /* log2 of the size of RAM covered by one shard in turn */
+    unsigned int shard_shift;
+    unsigned int users;
+} xbzrle_send_cache;
+
+struct xbzrle_data {
+    /* big-endian length of each normal page, see above */
+    uint32_t *lens;
+    /* page data or XBZRLE-encoded data of each normal page */
+    uint8_t *buf;
+    /* aligned copy of the page being encoded */
+    uint8_t *page;
+};
+
+static int xbzrle_send_cache_init(uint32_t page_size, Error **errp)
+{
+    uint64_t cache_pages = migrate_xbzrle_cache_size() / page_size;
+    uint64_t shard_pages;
+    unsigned int i;
+
+    if (!cache_pages) {
+        error_setg(errp, "multifd: xbzrle cache is smaller than one page");
+        return -1;
+    }
+
+    cache_pages = pow2floor(cache_pages);
+    xbzrle_send_cache.num_shards = MIN(pow2floor(migrate_multifd_channels()),
+                                       cache_pages);
+    shard_pages = cache_pages / xbzrle_send_cache.num_shards;
+    xbzrle_send_cache.shard_shift = ctz64(shard_pages) + ctz32(page_size);
+    xbzrle_send_cache.shards = g_new0(XbzrleCacheShard,
+                                      xbzrle_send_cache.num_shards);
+
+    for (i = 0; i < xbzrle_send_cache.num_shards; i++) {
+        qemu_mutex_init(&xbzrle_send_cache.shards[i].lock);
+    }
+    for (i = 0; i < xbzrle_send_cache.num_shards; i++) {
+        XbzrleCacheShard *shard = &xbzrle_send_cache.shards[i];
+
+        shard->cache = cache_init(shard_pages * page_size, page_size, errp);
+        if (!shard->cache) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void xbzrle_send_cache_fini(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < xbzrle_send_cache.num_shards; i++) {
+        XbzrleCacheShard *shard = &xbzrle_send_cache.shards[i];
+
+        if (shard->cache) {
+            cache_fini(shard->cache);
+        }
+        qemu_mutex_destroy(&shard->lock);
+    }
+    g_free(xbzrle_send_cache.shards);
+    xbzrle_send_cache.shards = NULL;
+    xbzrle_send_cache.num_shards = 0;
+}
+
+/*
+ * Consecutive ranges of (1 << shard_shift) bytes go to consecutive
+ * shards, so that all entries of each shard can be used.
+ */
+static XbzrleCacheShard *xbzrle_cache_shard(ram_addr_t addr)
+{
+    unsigned int i = (addr >> xbzrle_send_cache.shard_shift) &
+                     (xbzrle_send_cache.num_shards - 1);
+
+    return &xbzrle_send_cache.shards[i];
+}
+
+/**
+ * xbzrle_send_setup: setup send side
+ *
+ * Setup each channel with XBZRLE compression; the first one also
+ * creates the shared page cache.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+
+    if (!xbzrle_send_cache.users &&
+        xbzrle_send_cache_init(p->page_size, errp) < 0) {
+        xbzrle_send_cache_fini();
+        return -1;
+    }
+    xbzrle_send_cache.users++;
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->lens = g_new0(uint32_t, p->page_count);
+    x->buf = g_malloc((size_t)p->page_count * p->page_size);
+    x->page = g_malloc(p->page_size);
+    p->compress_data = x;
+
+    /* Needs 3 IOVs: packet header, page lengths and page data */
+    p->iov = g_new0(struct iovec, 3);
+
+    return 0;
+}
+
+/**
+ * xbzrle_send_cleanup: cleanup send side
+ *
+ * Return memory; the last channel also frees the shared page cache.
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static void xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (!x) {
+        return;
+    }
+
+    g_free(x->lens);
+    g_free(x->buf);
+    g_free(x->page);
+    g_free(x);
+    p->compress_data = NULL;
+
+    g_free(p->iov);
+    p->iov = NULL;
+
+    if (!--xbzrle_send_cache.users) {
+        xbzrle_send_cache_fini();
+    }
+}
+
+/*
+ * The destination clears zero pages, so a cached copy must be cleared
+ * too for the next delta to apply to the right contents.
+ */
+static void xbzrle_cache_zero_page(MultiFDSendParams *p, ram_addr_t addr,
+                                   uint64_t age)
+{
+    XbzrleCacheShard *shard = xbzrle_cache_shard(addr);
+
+    qemu_mutex_lock(&shard->lock);
+    if (cache_is_cached(shard->cache, addr, age)) {
+        memset(get_cached_data(shard->cache, addr), 0, p->page_size);
+    }
+    qemu_mutex_unlock(&shard->lock);
+}
+
+/**
+ * xbzrle_send_prepare: prepare date to be able to send
+ *
+ * Encode each page against its cached copy when there is one, and
+ * update the cache with what the destination will have.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    struct xbzrle_data *x = p->compress_data;
+    uint64_t age = stat64_get(&mig_stats.dirty_sync_count);
+    uint32_t out_size = 0, encoded = 0;
+    uint32_t i;
+
+    multifd_send_zero_page_detect(p);
+    multifd_send_prepare_header(p);
+
+    for (i = pages->normal_num; i < pages->num; i++) {
+        xbzrle_cache_zero_page(p, pages->block->offset + pages->offset[i],
+                               age);
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+        XbzrleCacheShard *shard = xbzrle_cache_shard(addr);
+        uint8_t *host = pages->block->host + pages->offset[i];
+        uint8_t *out = x->buf + out_size;
+        int len = -1;
+
+        qemu_mutex_lock(&shard->lock);
+        if (cache_is_cached(shard->cache, addr, age)) {
+            uint8_t *cached = get_cached_data(shard->cache, addr);
+
+            /*
+             * The guest may be writing to the page: encode a stable copy,
+             * and make it what the cache and the destination will have.
+             * An encoding that is not smaller than the page is useless.
+             */
+            memcpy(x->page, host, p->page_size);
+            len = xbzrle_encode_buffer(cached, x->page, p->page_size,
+                                       out, p->page_size - 1);
+            memcpy(cached, x->page, p->page_size);
+            if (len < 0) {
+                memcpy(out, x->page, p->page_size);
+            }
+        } else {
+            memcpy(out, host, p->page_size);
+            cache_insert(shard->cache, addr, out, age);
+        }
+        qemu_mutex_unlock(&shard->lock);
+
+        if (len < 0) {
+            len = p->page_size;
+        } else {
+            encoded++;
+        }
+        x->lens[i] = cpu_to_be32(len);
+        out_size += len;
+    }
+
+    if (pages->normal_num) {
+        p->iov[p->iovs_num].iov_base = x->lens;
+        p->iov[p->iovs_num].iov_len = pages->normal_num * sizeof(uint32_t);
+        p->iovs_num++;
+    }
+    if (out_size) {
+        p->iov[p->iovs_num].iov_base = x->buf;
+        p->iov[p->iovs_num].iov_len = out_size;
+        p->iovs_num++;
+    }
+    p->next_packet_size = pages->normal_num * sizeof(uint32_t) + out_size;
+
+    trace_multifd_xbzrle_send(p->id, pages->normal_num, encoded,
+                              p->next_packet_size);
+
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+/**
+ * xbzrle_recv_setup: setup receive side
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    x->lens = g_new0(uint32_t, p->page_count);
+    x->buf = g_malloc((size_t)p->page_count * p->page_size);
+    p->compress_data = x;
+    p->iov = g_new0(struct iovec, 2);
+    return 0;
+}
+
+/**
+ * xbzrle_recv_cleanup: cleanup receive side
+ *
+ * @p: Params for the channel that we are using
+ */
+static void xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (x) {
+        g_free(x->lens);
+        g_free(x->buf);
+        g_free(x);
+        p->compress_data = NULL;
+    }
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+/**
+ * xbzrle_recv: read the data from the channel into actual pages
+ *
+ * Copy raw pages, and apply XBZRLE-encoded ones to the current
+ * contents of the page.
+ *
+ * Returns 0 for success or -1 for error
+ *
+ * @p: Params for the channel that we are using
+ * @errp: pointer to an error
+ */
+static int xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t lens_size = p->normal_num * sizeof(uint32_t);
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t offset = 0;
+    int ret;
+    int i;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size < lens_size ||
+        in_size - lens_size > p->normal_num * p->page_size) {
+        error_setg(errp, "multifd %u: packet size received %u is invalid "
+                   "for %u pages", p->id, in_size, p->normal_num);
+        return -1;
+    }
+
+    p->iov[0].iov_base = x->lens;
+    p->iov[0].iov_len = lens_size;
+    p->iov[1].iov_base = x->buf;
+    p->iov[1].iov_len = in_size - lens_size;
+    ret = qio_channel_readv_all(p->c, p->iov, in_size > lens_size ? 2 : 1,
+                                errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint32_t len = be32_to_cpu(x->lens[i]);
+        uint8_t *page = p->host + p->normal[i];
+
+        if (len > p->page_size || len > in_size - lens_size - offset) {
+            error_setg(errp, "multifd %u: invalid length %u for page %d",
+                       p->id, len, i);
+            return -1;
+        }
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (len == p->page_size) {
+            memcpy(page, x->buf + offset, len);
+        } else if (xbzrle_decode_buffer(x->buf + offset, len, page,
+                                        p->page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode XBZRLE page %d",
+                       p->id, i);
+            return -1;
+        }
+        offset += len;
+    }
+
+    if (offset != in_size - lens_size) {
+        error_setg(errp, "multifd %u: packet size received %u size used %u",
+                   p->id, in_size, lens_size + offset);
+        return -1;
+    }
+
+    return 0;
+}
+
+static MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = xbzrle_send_setup,
+    .send_cleanup = xbzrle_send_cleanup,
+    .send_prepare = xbzrle_send_prepare,
+    .recv_setup = xbzrle_recv_setup,
+    .recv_cleanup = xbzrle_recv_cleanup,
+    .recv = xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
@@ -79,6 +79,9 @@ struct {
     int exiting;
     /* multifd ops */
     MultiFDMethods *ops;
+    /* scan request, only changed while no channel has pending_scan set */
+    MultiFDScanFunc scan_func;
+    void *scan_opaque;
 } *multifd_send_state;
 
 struct {
@@ -567,6 +570,47 @@ static void multifd_send_kick_main(MultiFDSendParams *p)
     qemu_sem_post(&multifd_send_state->channels_ready);
 }
 
+/*
+ * Send the pages queued in p->pages from the channel thread, and leave
+ * p->pages empty.  Returns 0 on success, or -1 with @errp set.
+ */
+static int multifd_send_channel_pages(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+    int ret;
+
+    p->iovs_num = 0;
+    assert(pages->num);
+
+    ret = multifd_send_state->ops->send_prepare(p, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (migrate_mapped_ram()) {
+        ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
+                                      p->pages->block, errp);
+    } else {
+        ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
+                                          NULL, 0, p->write_flags,
+                                          errp);
+    }
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    stat64_add(&mig_stats.multifd_bytes,
+               p->next_packet_size + p->packet_len);
+    stat64_add(&mig_stats.normal_pages, pages->normal_num);
+    stat64_add(&mig_stats.zero_pages, pages->num - pages->normal_num);
+
+    multifd_pages_reset(p->pages);
+    p->next_packet_size = 0;
+
+    return 0;
+}
+
 /*
  * How we use multifd_send_state->pages and channel->pages?
  *
@@ -689,6 +733,35 @@ retry:
     return true;
 }
 
+/*
+ * Version of multifd_queue_page() for use by a scan function: the pages
+ * are queued and sent by the channel @p itself.  Only valid while @p
+ * runs a scan request.
+ *
+ * Returns true if enqueue successful, false with @errp set otherwise.
+ */
+bool multifd_channel_queue_page(MultiFDSendParams *p, RAMBlock *block,
+                                ram_addr_t offset, Error **errp)
+{
+    MultiFDPages_t *pages = p->pages;
+
+    if (multifd_send_should_exit()) {
+        error_setg(errp, "multifd: migration is exiting");
+        return false;
+    }
+
+    if (!multifd_queue_empty(pages) &&
+        (pages->block != block || multifd_queue_full(pages))) {
+        if (multifd_send_channel_pages(p, errp) != 0) {
+            return false;
+        }
+    }
+
+    pages->block = block;
+    multifd_enqueue(pages, offset);
+    return true;
+}
+
 /* Multifd send side hit an error; remember it and prepare to quit */
 static void multifd_send_set_error(Error *err)
 {
@@ -854,6 +927,58 @@ static int multifd_zero_copy_flush(QIOChannel *c)
     return ret;
 }
 
+/*
+ * Have every channel run @func, which finds pages to send and queues them
+ * with multifd_channel_queue_page(), and wait until all of them are done.
+ * This lets the channels look for dirty pages in parallel rather than
+ * depend on the migration thread to feed them.
+ *
+ * Returns 0 on success, -1 if multifd is exiting.
+ */
+int multifd_send_scan(MultiFDScanFunc func, void *opaque)
+{
+    int i;
+
+    if (multifd_send_state->pages->num) {
+        if (!multifd_send_pages()) {
+            error_report("%s: multifd_send_pages fail", __func__);
+            return -1;
+        }
+    }
+
+    if (multifd_send_should_exit()) {
+        return -1;
+    }
+
+    multifd_send_state->scan_func = func;
+    multifd_send_state->scan_opaque = opaque;
+
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        trace_multifd_send_scan_signal(p->id);
+        assert(qatomic_read(&p->pending_scan) == false);
+        qatomic_set(&p->pending_scan, true);
+        qemu_sem_post(&p->sem);
+    }
+
+    /*
+     * @opaque must remain valid until every channel is done with it, so
+     * wait for all of them even if one fails.  A channel that fails
+     * posts sem_sync and channels_ready in multifd_send_kick_main(), and
+     * the other ones see that multifd is exiting when they queue a page.
+     */
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_sem_wait(&multifd_send_state->channels_ready);
+        trace_multifd_send_scan_wait(p->id);
+        qemu_sem_wait(&p->sem_sync);
+    }
+
+    return multifd_send_should_exit() ? -1 : 0;
+}
+
 int multifd_send_sync_main(void)
 {
     int i;
@@ -941,43 +1066,30 @@ static void *multifd_send_thread(void *opaque)
          * qatomic_store_release() in multifd_send_pages().
          */
         if (qatomic_load_acquire(&p->pending_job)) {
-            MultiFDPages_t *pages = p->pages;
-
-            p->iovs_num = 0;
-            assert(pages->num);
-
-            ret = multifd_send_state->ops->send_prepare(p, &local_err);
-            if (ret != 0) {
-                break;
-            }
-
-            if (migrate_mapped_ram()) {
-                ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
-                                              p->pages->block, &local_err);
-            } else {
-                ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
-                                                  NULL, 0, p->write_flags,
-                                                  &local_err);
-            }
-
+            ret = multifd_send_channel_pages(p, &local_err);
             if (ret != 0) {
                 break;
             }
 
-            stat64_add(&mig_stats.multifd_bytes,
-                       p->next_packet_size + p->packet_len);
-            stat64_add(&mig_stats.normal_pages, pages->normal_num);
-            stat64_add(&mig_stats.zero_pages, pages->num - pages->normal_num);
-
-            multifd_pages_reset(p->pages);
-            p->next_packet_size = 0;
-
             /*
              * Making sure p->pages is published before saying "we're
              * free".  Pairs with the smp_mb_acquire() in
              * multifd_send_pages().
              */
             qatomic_store_release(&p->pending_job, false);
+        } else if (qatomic_read(&p->pending_scan)) {
+            ret = multifd_send_state->scan_func(p,
+                                                multifd_send_state->scan_opaque,
+                                                &local_err);
+            if (ret == 0 && !multifd_queue_empty(p->pages)) {
+                ret = multifd_send_channel_pages(p, &local_err);
+            }
+            if (ret != 0) {
+                break;
+            }
+
+            qatomic_set(&p->pending_scan, false);
+            qemu_sem_post(&p->sem_sync);
         } else {
             /*
              * If not a normal job, must be a sync request.  Note that
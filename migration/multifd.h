@@ -34,14 +34,20 @@ MultiFDRecvData *multifd_get_recv_data(void);
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
-/* We reserve 4 bits for compression methods */
-#define MULTIFD_FLAG_COMPRESSION_MASK (0xf << 1)
+/* We reserve 5 bits for compression methods */
+#define MULTIFD_FLAG_COMPRESSION_MASK (0x1f << 1)
 /* we need to be compatible. Before compression value was 0 */
 #define MULTIFD_FLAG_NOCOMP (0 << 1)
 #define MULTIFD_FLAG_ZLIB (1 << 1)
 #define MULTIFD_FLAG_ZSTD (2 << 1)
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
+/*
+ * Each method has a bit of its own, so that its value never looks like a
+ * combination of other methods.  The first four bits are taken, so
+ * XBZRLE uses a fifth one.
+ */
+#define MULTIFD_FLAG_XBZRLE (16 << 1)
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
@@ -125,16 +131,19 @@ typedef struct {
      *
      * @pending_job:  a job is pending
      * @pending_sync: a sync request is pending
+     * @pending_scan: a scan request is pending, see multifd_send_scan()
      *
-     * For both of these fields, they're only set by the requesters, and
+     * For all of these fields, they're only set by the requesters, and
      * cleared by the multifd sender threads.
      */
     bool pending_job;
     bool pending_sync;
+    bool pending_scan;
     /* array of pages to sent.
      * The owner of 'pages' depends of 'pending_job' value:
      * pending_job == 0 -> migration_thread can use it.
      * pending_job != 0 -> multifd_channel can use it.
+     * While a scan request runs, the channel fills and sends it itself.
      */
     MultiFDPages_t *pages;
 
@@ -239,6 +248,17 @@ typedef struct {
     int (*recv)(MultiFDRecvParams *p, Error **errp);
 } MultiFDMethods;
 
+/*
+ * Runs in a multifd send thread, see multifd_send_scan().  Returns 0 on
+ * success, or -1 with @errp set.
+ */
+typedef int (*MultiFDScanFunc)(MultiFDSendParams *p, void *opaque,
+                               Error **errp);
+
+int multifd_send_scan(MultiFDScanFunc func, void *opaque);
+bool multifd_channel_queue_page(MultiFDSendParams *p, RAMBlock *block,
+                                ram_addr_t offset, Error **errp);
+
 void multifd_register_ops(int method, MultiFDMethods *ops);
 void multifd_send_fill_packet(MultiFDSendParams *p);
 bool multifd_send_prepare_common(MultiFDSendParams *p);
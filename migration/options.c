@@ -57,6 +57,7 @@
 #define DEFAULT_MIGRATE_MULTIFD_ZLIB_LEVEL 1
 /* 0: means nocompress, 1: best speed, ... 20: best compress ratio */
 #define DEFAULT_MIGRATE_MULTIFD_ZSTD_LEVEL 1
+#define DEFAULT_MIGRATE_DIRTY_SYNC_THREADS 1
 
 /* Background transfer rate for postcopy, 0 means unlimited, note
  * that page requests can still exceed this limit.
@@ -162,6 +163,15 @@ Property migration_properties[] = {
     DEFINE_PROP_ZERO_PAGE_DETECTION("zero-page-detection", MigrationState,
                        parameters.zero_page_detection,
                        ZERO_PAGE_DETECTION_MULTIFD),
+    DEFINE_PROP_UINT8("dirty-sync-threads", MigrationState,
+                      parameters.dirty_sync_threads,
+                      DEFAULT_MIGRATE_DIRTY_SYNC_THREADS),
+    DEFINE_PROP_BOOL("multifd-parallel-scan", MigrationState,
+                     parameters.multifd_parallel_scan, false),
+    DEFINE_PROP_UINT8("postcopy-prefetch-pages", MigrationState,
+                      parameters.postcopy_prefetch_pages, 0),
+    DEFINE_PROP_BOOL("skip-unpopulated-ram", MigrationState,
+                     parameters.skip_unpopulated_ram, false),
 
     /* Migration capabilities */
     DEFINE_PROP_MIG_CAP("x-xbzrle", MIGRATION_CAPABILITY_XBZRLE),
@@ -721,6 +731,13 @@ bool migrate_direct_io(void)
         s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
 }
 
+int migrate_dirty_sync_threads(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.dirty_sync_threads;
+}
+
 uint64_t migrate_downtime_limit(void)
 {
     MigrationState *s = migrate_get_current();
@@ -780,6 +797,22 @@ MultiFDCompression migrate_multifd_compression(void)
     return s->parameters.multifd_compression;
 }
 
+bool migrate_multifd_parallel_scan(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    /*
+     * The multifd channels cannot serve postcopy page requests, write
+     * to a file at fixed offsets or send legacy zero pages on the main
+     * stream, so keep the single scanner for those.
+     */
+    return s->parameters.multifd_parallel_scan &&
+        s->capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+        !s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_RAM] &&
+        !s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] &&
+        s->parameters.zero_page_detection != ZERO_PAGE_DETECTION_LEGACY;
+}
+
 int migrate_multifd_zlib_level(void)
 {
     MigrationState *s = migrate_get_current();
@@ -794,6 +827,20 @@ int migrate_multifd_zstd_level(void)
     return s->parameters.multifd_zstd_level;
 }
 
+uint8_t migrate_postcopy_prefetch_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.postcopy_prefetch_pages;
+}
+
+bool migrate_skip_unpopulated_ram(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->parameters.skip_unpopulated_ram;
+}
+
 uint8_t migrate_throttle_trigger_threshold(void)
 {
     MigrationState *s = migrate_get_current();
@@ -926,6 +973,14 @@ MigrationParameters *qmp_query_migrate_parameters(Error **errp)
     params->zero_page_detection = s->parameters.zero_page_detection;
     params->has_direct_io = true;
     params->direct_io = s->parameters.direct_io;
+    params->has_dirty_sync_threads = true;
+    params->dirty_sync_threads = s->parameters.dirty_sync_threads;
+    params->has_multifd_parallel_scan = true;
+    params->multifd_parallel_scan = s->parameters.multifd_parallel_scan;
+    params->has_postcopy_prefetch_pages = true;
+    params->postcopy_prefetch_pages = s->parameters.postcopy_prefetch_pages;
+    params->has_skip_unpopulated_ram = true;
+    params->skip_unpopulated_ram = s->parameters.skip_unpopulated_ram;
 
     return params;
 }
@@ -959,6 +1014,10 @@ void migrate_params_init(MigrationParameters *params)
     params->has_mode = true;
     params->has_zero_page_detection = true;
     params->has_direct_io = true;
+    params->has_dirty_sync_threads = true;
+    params->has_multifd_parallel_scan = true;
+    params->has_postcopy_prefetch_pages = true;
+    params->has_skip_unpopulated_ram = true;
 }
 
 /*
@@ -1109,6 +1168,15 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        params->has_zero_page_detection &&
+        params->zero_page_detection == ZERO_PAGE_DETECTION_LEGACY) {
+        error_setg(errp, "Multifd xbzrle compression is not compatible "
+                   "with legacy zero page detection");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
@@ -1137,6 +1205,13 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
         return false;
     }
 
+    if (params->has_dirty_sync_threads && params->dirty_sync_threads < 1) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+                   "dirty_sync_threads",
+                   "a value between 1 and 255");
+        return false;
+    }
+
     return true;
 }
 
@@ -1247,6 +1322,22 @@ static void migrate_params_test_apply(MigrateSetParameters *params,
     if (params->has_direct_io) {
         dest->direct_io = params->direct_io;
     }
+
+    if (params->has_dirty_sync_threads) {
+        dest->dirty_sync_threads = params->dirty_sync_threads;
+    }
+
+    if (params->has_multifd_parallel_scan) {
+        dest->multifd_parallel_scan = params->multifd_parallel_scan;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        dest->postcopy_prefetch_pages = params->postcopy_prefetch_pages;
+    }
+
+    if (params->has_skip_unpopulated_ram) {
+        dest->skip_unpopulated_ram = params->skip_unpopulated_ram;
+    }
 }
 
 static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
@@ -1376,6 +1467,23 @@ static void migrate_params_apply(MigrateSetParameters *params, Error **errp)
     if (params->has_direct_io) {
         s->parameters.direct_io = params->direct_io;
     }
+
+    if (params->has_dirty_sync_threads) {
+        s->parameters.dirty_sync_threads = params->dirty_sync_threads;
+    }
+
+    if (params->has_multifd_parallel_scan) {
+        s->parameters.multifd_parallel_scan = params->multifd_parallel_scan;
+    }
+
+    if (params->has_postcopy_prefetch_pages) {
+        s->parameters.postcopy_prefetch_pages =
+            params->postcopy_prefetch_pages;
+    }
+
+    if (params->has_skip_unpopulated_ram) {
+        s->parameters.skip_unpopulated_ram = params->skip_unpopulated_ram;
+    }
 }
 
 void qmp_migrate_set_parameters(MigrateSetParameters *params, Error **errp)
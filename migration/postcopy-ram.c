@@ -958,17 +958,96 @@ static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
     trace_postcopy_pause_fault_thread_continued();
 }
 
+/*
+ * Prefetching: the fault thread remembers the last fault of a few vCPU
+ * threads (as reported by UFFD_FEATURE_THREAD_ID, or a single one without
+ * it) and, whenever one of them faults, requests the pages it is expected
+ * to touch next.  A thread that faulted twice in a row at the same small
+ * distance is assumed to walk memory with that stride; for anything else
+ * the adjacent pages are requested.
+ */
+#define POSTCOPY_PREFETCH_STREAMS       64
+/* Larger strides, in host pages, are considered random accesses */
+#define POSTCOPY_PREFETCH_MAX_STRIDE    64
+
+typedef struct PostcopyPrefetchStream {
+    uint32_t ptid;
+    RAMBlock *rb;
+    /* Host page index of the last fault, and distance from the previous */
+    uint64_t page;
+    int64_t delta;
+} PostcopyPrefetchStream;
+
+static void postcopy_prefetch(MigrationIncomingState *mis,
+                              PostcopyPrefetchStream *streams,
+                              unsigned int npages, RAMBlock *rb,
+                              ram_addr_t rb_offset, uint32_t ptid)
+{
+    PostcopyPrefetchStream *s = &streams[ptid % POSTCOPY_PREFETCH_STREAMS];
+    size_t page_size = qemu_ram_pagesize(rb);
+    uint64_t page = rb_offset / page_size;
+    uint64_t last = qemu_ram_get_used_length(rb) / page_size;
+    int64_t stride = 1;
+    unsigned int i;
+
+    if (s->ptid == ptid && s->rb == rb) {
+        int64_t delta = page - s->page;
+
+        if (delta && delta == s->delta &&
+            ABS(delta) <= POSTCOPY_PREFETCH_MAX_STRIDE) {
+            stride = delta;
+        }
+        s->delta = delta;
+    } else {
+        s->ptid = ptid;
+        s->rb = rb;
+        s->delta = 0;
+    }
+    s->page = page;
+
+    /*
+     * Errors are not fatal here: the pages are already tracked as
+     * requested, and are requested again once the fault thread recovers.
+     */
+    if (stride == 1) {
+        npages = MIN(npages, last - page - 1);
+        migrate_send_rp_prefetch_pages(mis, rb, (page + 1) * page_size,
+                                       npages);
+    } else if (stride == -1) {
+        npages = MIN(npages, page);
+        migrate_send_rp_prefetch_pages(mis, rb, (page - npages) * page_size,
+                                       npages);
+    } else {
+        for (i = 1; i <= npages; i++) {
+            int64_t next = page + i * stride;
+
+            if (next < 0 || next >= last) {
+                break;
+            }
+            if (migrate_send_rp_prefetch_pages(mis, rb, next * page_size, 1)) {
+                break;
+            }
+        }
+    }
+}
+
 /*
  * Handle faults detected by the USERFAULT markings
  */
 static void *postcopy_ram_fault_thread(void *opaque)
 {
     MigrationIncomingState *mis = opaque;
+    unsigned int prefetch_pages = migrate_postcopy_prefetch_pages();
+    g_autofree PostcopyPrefetchStream *prefetch = NULL;
     struct uffd_msg msg;
     int ret;
     size_t index;
     RAMBlock *rb = NULL;
 
+    if (prefetch_pages) {
+        prefetch = g_new0(PostcopyPrefetchStream, POSTCOPY_PREFETCH_STREAMS);
+    }
+
     trace_postcopy_ram_fault_thread_entry();
     rcu_register_thread();
     mis->last_rb = NULL; /* last RAMBlock we sent part of */
@@ -1092,6 +1171,11 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+
+            if (prefetch) {
+                postcopy_prefetch(mis, prefetch, prefetch_pages, rb,
+                                  rb_offset, msg.arg.pagefault.feat.ptid);
+            }
         }
 
         /* Now handle any requests from external processes on shared memory */
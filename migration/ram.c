@@ -32,6 +32,7 @@
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -414,9 +415,45 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+
+    /* Helper threads for dirty bitmap sync, NULL if there are none */
+    struct DirtySyncThreads *dirty_sync_threads;
+    /* State of the multifd parallel scan, NULL if it is not used */
+    struct MultiFDScan *multifd_scan;
 };
 typedef struct RAMState RAMState;
 
+/*
+ * With more than one dirty-sync-threads, the dirty bitmap of each RAMBlock
+ * is synchronized in jobs of up to this size.  This is a multiple of
+ * BITS_PER_LONG target pages, so that concurrent jobs never touch the same
+ * word of the bitmaps.
+ */
+#define DIRTY_SYNC_JOB_SIZE (1 * GiB)
+
+typedef struct DirtySyncJob {
+    RAMBlock *block;
+    ram_addr_t start;
+    ram_addr_t length;
+} DirtySyncJob;
+
+typedef struct DirtySyncThreads {
+    QemuThread *threads;
+    int num_threads;
+    /* Posted once per thread to start a synchronization, or to quit */
+    QemuSemaphore sem_start;
+    /* Posted by each thread once there are no jobs left */
+    QemuSemaphore sem_done;
+    bool quit;
+
+    /* Set up by the migration thread before posting sem_start */
+    GArray *jobs;
+    /* Index of the next job to run (atomic) */
+    unsigned int next_job;
+    /* Dirty pages found by all threads */
+    Stat64 new_dirty_pages;
+} DirtySyncThreads;
+
 static RAMState *ram_state;
 
 static NotifierWithReturnList precopy_notifier_list;
@@ -922,6 +959,149 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/* Called with RCU critical section */
+static void dirty_sync_run_jobs(DirtySyncThreads *ds)
+{
+    uint64_t new_dirty_pages = 0;
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&ds->next_job)) < ds->jobs->len) {
+        DirtySyncJob *job = &g_array_index(ds->jobs, DirtySyncJob, i);
+
+        new_dirty_pages += cpu_physical_memory_sync_dirty_bitmap(job->block,
+                                                                 job->start,
+                                                                 job->length);
+    }
+
+    stat64_add(&ds->new_dirty_pages, new_dirty_pages);
+}
+
+static void *dirty_sync_thread(void *opaque)
+{
+    DirtySyncThreads *ds = opaque;
+
+    rcu_register_thread();
+
+    while (true) {
+        qemu_sem_wait(&ds->sem_start);
+        if (qatomic_read(&ds->quit)) {
+            break;
+        }
+
+        WITH_RCU_READ_LOCK_GUARD() {
+            dirty_sync_run_jobs(ds);
+        }
+        qemu_sem_post(&ds->sem_done);
+    }
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static DirtySyncThreads *dirty_sync_threads_create(int num_threads)
+{
+    DirtySyncThreads *ds = g_new0(DirtySyncThreads, 1);
+    int i;
+
+    ds->threads = g_new0(QemuThread, num_threads);
+    ds->num_threads = num_threads;
+    ds->jobs = g_array_new(false, false, sizeof(DirtySyncJob));
+    qemu_sem_init(&ds->sem_start, 0);
+    qemu_sem_init(&ds->sem_done, 0);
+
+    for (i = 0; i < num_threads; i++) {
+        qemu_thread_create(&ds->threads[i], "mig/src/dsync",
+                           dirty_sync_thread, ds, QEMU_THREAD_JOINABLE);
+    }
+
+    return ds;
+}
+
+static void dirty_sync_threads_destroy(DirtySyncThreads *ds)
+{
+    int i;
+
+    if (!ds) {
+        return;
+    }
+
+    qatomic_set(&ds->quit, true);
+    for (i = 0; i < ds->num_threads; i++) {
+        qemu_sem_post(&ds->sem_start);
+    }
+    for (i = 0; i < ds->num_threads; i++) {
+        qemu_thread_join(&ds->threads[i]);
+    }
+
+    qemu_sem_destroy(&ds->sem_start);
+    qemu_sem_destroy(&ds->sem_done);
+    g_array_free(ds->jobs, true);
+    g_free(ds->threads);
+    g_free(ds);
+}
+
+/*
+ * Synchronize the dirty bitmap of all RAMBlocks, splitting the work between
+ * the migration thread and the dirty sync threads.
+ *
+ * Called with RCU critical section and bitmap_mutex held
+ */
+static void ramblock_sync_dirty_bitmap_all(RAMState *rs)
+{
+    int num_threads = migrate_dirty_sync_threads() - 1;
+    DirtySyncThreads *ds = rs->dirty_sync_threads;
+    uint64_t new_dirty_pages;
+    RAMBlock *block;
+    int i;
+
+    if (ds && ds->num_threads != num_threads) {
+        dirty_sync_threads_destroy(ds);
+        ds = rs->dirty_sync_threads = NULL;
+    }
+
+    if (num_threads <= 0) {
+        RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+            ramblock_sync_dirty_bitmap(rs, block);
+        }
+        return;
+    }
+
+    if (!ds) {
+        ds = rs->dirty_sync_threads = dirty_sync_threads_create(num_threads);
+    }
+
+    g_array_set_size(ds->jobs, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        for (start = 0; start < block->used_length;
+             start += DIRTY_SYNC_JOB_SIZE) {
+            DirtySyncJob job = {
+                .block = block,
+                .start = start,
+                .length = MIN(DIRTY_SYNC_JOB_SIZE, block->used_length - start),
+            };
+            g_array_append_val(ds->jobs, job);
+        }
+    }
+
+    qatomic_set(&ds->next_job, 0);
+    stat64_set(&ds->new_dirty_pages, 0);
+    for (i = 0; i < num_threads; i++) {
+        qemu_sem_post(&ds->sem_start);
+    }
+
+    dirty_sync_run_jobs(ds);
+
+    for (i = 0; i < num_threads; i++) {
+        qemu_sem_wait(&ds->sem_done);
+    }
+
+    new_dirty_pages = stat64_get(&ds->new_dirty_pages);
+    rs->migration_dirty_pages += new_dirty_pages;
+    rs->num_dirty_pages_period += new_dirty_pages;
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -1043,8 +1223,8 @@ static void migration_trigger_throttle(RAMState *rs)
 
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
-    RAMBlock *block;
     int64_t end_time;
+    int64_t start_us, log_us, bitmap_us, end_us;
 
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
@@ -1053,20 +1233,29 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
     }
 
     trace_migration_bitmap_sync_start();
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     memory_global_dirty_log_sync(last_stage);
+    log_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
-            }
+            ramblock_sync_dirty_bitmap_all(rs);
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
     }
+    bitmap_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
     memory_global_after_dirty_log_sync();
+    end_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
 
+    stat64_set(&mig_stats.dirty_sync_time, end_us - start_us);
+    stat64_set(&mig_stats.dirty_sync_log_time, log_us - start_us);
+    stat64_set(&mig_stats.dirty_sync_bitmap_time, bitmap_us - log_us);
+    trace_migration_bitmap_sync_time(log_us - start_us, bitmap_us - log_us,
+                                     end_us - start_us,
+                                     migrate_dirty_sync_threads());
+
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
     /* more than 1 second = 1000 millisecons */
@@ -1286,6 +1475,32 @@ static int ram_save_multifd_page(RAMBlock *block, ram_addr_t offset)
 }
 
 
+/*
+ * Called when the search for dirty pages has gone through all RAMBlocks
+ * and starts again from the first one.
+ *
+ * Returns 0 on success, negative on error.
+ */
+static int ram_multifd_round_sync(RAMState *rs)
+{
+    if (migrate_multifd() &&
+        (!migrate_multifd_flush_after_each_section() ||
+         migrate_mapped_ram())) {
+        QEMUFile *f = rs->pss[RAM_CHANNEL_PRECOPY].pss_channel;
+        int ret = multifd_send_sync_main();
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (!migrate_mapped_ram()) {
+            qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
+            qemu_fflush(f);
+        }
+    }
+
+    return 0;
+}
+
 #define PAGE_ALL_CLEAN 0
 #define PAGE_TRY_AGAIN 1
 #define PAGE_DIRTY_FOUND 2
@@ -1322,19 +1537,9 @@ static int find_dirty_block(RAMState *rs, PageSearchStatus *pss)
         pss->page = 0;
         pss->block = QLIST_NEXT_RCU(pss->block, next);
         if (!pss->block) {
-            if (migrate_multifd() &&
-                (!migrate_multifd_flush_after_each_section() ||
-                 migrate_mapped_ram())) {
-                QEMUFile *f = rs->pss[RAM_CHANNEL_PRECOPY].pss_channel;
-                int ret = multifd_send_sync_main();
-                if (ret < 0) {
-                    return ret;
-                }
-
-                if (!migrate_mapped_ram()) {
-                    qemu_put_be64(f, RAM_SAVE_FLAG_MULTIFD_FLUSH);
-                    qemu_fflush(f);
-                }
+            int ret = ram_multifd_round_sync(rs);
+            if (ret < 0) {
+                return ret;
             }
 
             /* Hit the end of the list */
@@ -2223,6 +2428,218 @@ static int ram_save_host_page(RAMState *rs, PageSearchStatus *pss)
     return (res < 0 ? res : pages);
 }
 
+/*
+ * Multifd parallel scan
+ *
+ * Instead of having the migration thread search the whole dirty bitmap
+ * and feed the pages to the multifd channels, each channel searches its
+ * own share of RAM and sends what it finds.  RAM is cut into stripes of
+ * MULTIFD_SCAN_STRIPE_SIZE, and stripe i belongs to channel i % channels,
+ * so every page is always sent by the same channel.
+ *
+ * A stripe covers whole clear_bmap chunks, so no two channels share a
+ * chunk or a word of the dirty bitmap.  The migration thread holds
+ * bitmap_mutex and the RCU read lock while the channels scan, and only
+ * applies the results once all of them are done.
+ */
+#define MULTIFD_SCAN_STRIPE_SIZE (1 * GiB)
+
+/*
+ * Number of pages a channel sends before giving control back to the
+ * migration thread, which checks the rate limit between rounds.
+ */
+#define MULTIFD_SCAN_ROUND_PAGES 2048
+
+typedef struct MultiFDScanStripe {
+    RAMBlock *block;
+    unsigned long start;
+    unsigned long end;
+} MultiFDScanStripe;
+
+typedef struct MultiFDScanChannel {
+    /* Next stripe to search and first page to look at in it */
+    unsigned int stripe;
+    unsigned long page;
+    /* Pages sent in the last round */
+    uint64_t pages;
+} MultiFDScanChannel;
+
+typedef struct MultiFDScan {
+    /* NULL until built, and again after ram_state_reset() */
+    GArray *stripes;
+    MultiFDScanChannel *channels;
+    unsigned int num_channels;
+    /* Pages sent since all channels last went through their stripes */
+    uint64_t pass_pages;
+} MultiFDScan;
+
+static MultiFDScan *ram_multifd_scan_create(void)
+{
+    MultiFDScan *scan = g_new0(MultiFDScan, 1);
+
+    scan->num_channels = migrate_multifd_channels();
+    scan->channels = g_new0(MultiFDScanChannel, scan->num_channels);
+    return scan;
+}
+
+static void ram_multifd_scan_reset(MultiFDScan *scan)
+{
+    unsigned int i;
+
+    if (!scan) {
+        return;
+    }
+
+    if (scan->stripes) {
+        g_array_free(scan->stripes, true);
+        scan->stripes = NULL;
+    }
+    for (i = 0; i < scan->num_channels; i++) {
+        scan->channels[i].stripe = i;
+        scan->channels[i].page = 0;
+    }
+    scan->pass_pages = 0;
+}
+
+static void ram_multifd_scan_destroy(MultiFDScan *scan)
+{
+    if (!scan) {
+        return;
+    }
+
+    ram_multifd_scan_reset(scan);
+    g_free(scan->channels);
+    g_free(scan);
+}
+
+/* Called with RCU critical section */
+static void ram_multifd_scan_build(MultiFDScan *scan)
+{
+    RAMBlock *block;
+
+    scan->stripes = g_array_new(false, false, sizeof(MultiFDScanStripe));
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        unsigned long pages = block->used_length >> TARGET_PAGE_BITS;
+        unsigned long stripe_pages = MAX(MULTIFD_SCAN_STRIPE_SIZE >>
+                                         TARGET_PAGE_BITS,
+                                         1UL << block->clear_bmap_shift);
+        unsigned long start;
+
+        for (start = 0; start < pages; start += stripe_pages) {
+            MultiFDScanStripe stripe = {
+                .block = block,
+                .start = start,
+                .end = MIN(start + stripe_pages, pages),
+            };
+
+            g_array_append_val(scan->stripes, stripe);
+        }
+    }
+}
+
+/*
+ * Runs in multifd send thread @p: send up to MULTIFD_SCAN_ROUND_PAGES
+ * dirty pages from the stripes of the channel.
+ */
+static int ram_multifd_scan_channel(MultiFDSendParams *p, void *opaque,
+                                    Error **errp)
+{
+    MultiFDScan *scan = opaque;
+    MultiFDScanChannel *c = &scan->channels[p->id];
+
+    c->pages = 0;
+    while (c->stripe < scan->stripes->len) {
+        MultiFDScanStripe *stripe = &g_array_index(scan->stripes,
+                                                   MultiFDScanStripe,
+                                                   c->stripe);
+        unsigned long page = find_next_bit(stripe->block->bmap, stripe->end,
+                                           MAX(c->page, stripe->start));
+
+        if (page >= stripe->end) {
+            c->stripe += scan->num_channels;
+            c->page = 0;
+            continue;
+        }
+
+        if (c->pages == MULTIFD_SCAN_ROUND_PAGES) {
+            break;
+        }
+
+        /* See migration_bitmap_clear_dirty() */
+        migration_clear_memory_region_dirty_bitmap(stripe->block, page);
+        clear_bit(page, stripe->block->bmap);
+
+        if (!multifd_channel_queue_page(p, stripe->block,
+                                        (ram_addr_t)page << TARGET_PAGE_BITS,
+                                        errp)) {
+            return -1;
+        }
+        c->pages++;
+        c->page = page + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Version of ram_find_and_save_block() for the multifd parallel scan.
+ *
+ * Called within an RCU critical section, with bitmap_mutex held.
+ *
+ * Returns the number of pages sent where zero means no dirty pages,
+ * or negative on error
+ */
+static int ram_multifd_scan_find_and_save(RAMState *rs)
+{
+    MultiFDScan *scan = rs->multifd_scan;
+
+    if (!scan->stripes) {
+        ram_multifd_scan_build(scan);
+    }
+
+    while (true) {
+        uint64_t pages = 0, pass_pages;
+        bool pass_done = true;
+        unsigned int i;
+        int ret;
+
+        if (multifd_send_scan(ram_multifd_scan_channel, scan) < 0) {
+            return -1;
+        }
+
+        for (i = 0; i < scan->num_channels; i++) {
+            pages += scan->channels[i].pages;
+            if (scan->channels[i].stripe < scan->stripes->len) {
+                pass_done = false;
+            }
+        }
+        rs->migration_dirty_pages -= pages;
+        scan->pass_pages += pages;
+
+        if (!pass_done) {
+            /* Some channel stopped at MULTIFD_SCAN_ROUND_PAGES */
+            return pages;
+        }
+
+        ret = ram_multifd_round_sync(rs);
+        if (ret < 0) {
+            return ret;
+        }
+
+        pass_pages = scan->pass_pages;
+        for (i = 0; i < scan->num_channels; i++) {
+            scan->channels[i].stripe = i;
+            scan->channels[i].page = 0;
+        }
+        scan->pass_pages = 0;
+
+        if (pages || !pass_pages) {
+            return pages;
+        }
+        /* The end of the pass was clean, but not all of it: go again */
+    }
+}
+
 /**
  * ram_find_and_save_block: finds a dirty page and sends it to f
  *
@@ -2246,6 +2663,10 @@ static int ram_find_and_save_block(RAMState *rs)
         return pages;
     }
 
+    if (rs->multifd_scan) {
+        return ram_multifd_scan_find_and_save(rs);
+    }
+
     /*
      * Always keep last_seen_block/last_page valid during this procedure,
      * because find_dirty_block() relies on these values (e.g., we compare
@@ -2324,9 +2745,13 @@ static void xbzrle_load_cleanup(void)
     XBZRLE.decoded_buf = NULL;
 }
 
+static void dirty_sync_threads_destroy(DirtySyncThreads *ds);
+
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        dirty_sync_threads_destroy((*rsp)->dirty_sync_threads);
+        ram_multifd_scan_destroy((*rsp)->multifd_scan);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2404,6 +2829,7 @@ static void ram_state_reset(RAMState *rs)
     rs->last_page = 0;
     rs->last_version = ram_list.version;
     rs->xbzrle_started = false;
+    ram_multifd_scan_reset(rs->multifd_scan);
 }
 
 #define MAX_WAIT 50 /* ms, half buffered_file limit */
@@ -2769,6 +3195,140 @@ static void migration_bitmap_clear_discarded_pages(RAMState *rs)
     }
 }
 
+#ifdef CONFIG_LINUX
+/* See Documentation/admin-guide/mm/pagemap.rst in the Linux tree */
+#define PAGEMAP_PRESENT     (1ULL << 63)
+#define PAGEMAP_SWAPPED     (1ULL << 62)
+#define PAGEMAP_BATCH       4096
+
+/*
+ * Private anonymous memory reads as zeroes as long as the kernel has not
+ * populated it.  Blocks backed by a file or by memory handed to us by
+ * someone else (RAM_PREALLOC) can have contents without a page table entry.
+ */
+static bool ramblock_is_private_anon(RAMBlock *rb)
+{
+    return rb->mr && rb->fd < 0 && !qemu_ram_is_shared(rb) &&
+           !(rb->flags & RAM_PREALLOC) &&
+           rb->page_size == qemu_real_host_page_size();
+}
+
+/*
+ * Clear the dirty bits of all target pages that are fully contained in the
+ * byte range [@start, @end) of the RAMBlock.  The remote dirty bitmap must
+ * have been cleared already.
+ */
+static void ramblock_dirty_bitmap_clear_range(RAMBlock *rb, ram_addr_t start,
+                                              ram_addr_t end,
+                                              uint64_t *cleared_bits)
+{
+    unsigned long first = DIV_ROUND_UP(start, TARGET_PAGE_SIZE);
+    unsigned long last = end >> TARGET_PAGE_BITS;
+
+    if (last <= first) {
+        return;
+    }
+    *cleared_bits += bitmap_count_one_with_offset(rb->bmap, first,
+                                                  last - first);
+    bitmap_clear(rb->bmap, first, last - first);
+}
+
+/*
+ * Exclude all dirty pages from migration that the host never populated,
+ * i.e. that have neither a page table entry nor a swap entry in
+ * /proc/self/pagemap (@fd).  They read as zeroes and, as the destination
+ * starts with zeroed RAM, there is no need to read or send them at all.
+ *
+ * The remote dirty bitmap of a range is cleared before its pagemap entries
+ * are read: a page the guest writes to after that gets dirtied again by
+ * the next sync, and one it wrote to before is seen as populated.  The
+ * other way round, a write in between would be lost with a dirty log that
+ * starts out as all set (KVM_DIRTY_LOG_INITIALLY_SET).
+ *
+ * Returns the number of cleared bits in the RAMBlock dirty bitmap.
+ */
+static uint64_t ramblock_dirty_bitmap_clear_unpopulated_pages(RAMBlock *rb,
+                                                              int fd)
+{
+    const size_t psize = qemu_real_host_page_size();
+    const uint64_t npages = qemu_ram_get_used_length(rb) / psize;
+    const off_t base = (uintptr_t)rb->host / psize * sizeof(uint64_t);
+    g_autofree uint64_t *entries = g_new(uint64_t, PAGEMAP_BATCH);
+    uint64_t cleared_bits = 0, run = 0, i = 0;
+    bool in_run = false;
+
+    while (i < npages) {
+        size_t n = MIN(npages - i, PAGEMAP_BATCH);
+        unsigned long first = (i * psize) >> TARGET_PAGE_BITS;
+        unsigned long last = DIV_ROUND_UP((i + n) * psize, TARGET_PAGE_SIZE);
+        ssize_t len;
+
+        migration_clear_memory_region_dirty_bitmap_range(rb, first,
+                                                         last - first);
+        len = pread(fd, entries, n * sizeof(uint64_t),
+                    base + i * sizeof(uint64_t));
+        if (len < (ssize_t)sizeof(uint64_t)) {
+            /* Keeping the remaining pages dirty is always safe */
+            break;
+        }
+        n = len / sizeof(uint64_t);
+        for (size_t j = 0; j < n; j++, i++) {
+            bool unpopulated =
+                !(entries[j] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED));
+
+            if (unpopulated && !in_run) {
+                run = i;
+                in_run = true;
+            } else if (!unpopulated && in_run) {
+                ramblock_dirty_bitmap_clear_range(rb, run * psize, i * psize,
+                                                  &cleared_bits);
+                in_run = false;
+            }
+        }
+    }
+    if (in_run) {
+        ramblock_dirty_bitmap_clear_range(rb, run * psize, i * psize,
+                                          &cleared_bits);
+    }
+    return cleared_bits;
+}
+
+static void migration_bitmap_clear_unpopulated_pages(RAMState *rs)
+{
+    uint64_t pages;
+    RAMBlock *rb;
+    int fd;
+
+    /*
+     * savevm is loaded into a VM that already ran, so every page must be
+     * in the stream.  With postcopy, the destination would fault on the
+     * missing pages and ask for them, but they are not dirty here.
+     * Background snapshots populate all of RAM before we get here.
+     */
+    if (!migrate_skip_unpopulated_ram() || runstate_check(RUN_STATE_SAVE_VM) ||
+        migrate_postcopy_ram() || migrate_background_snapshot()) {
+        return;
+    }
+
+    fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+            if (!rb->bmap || !ramblock_is_private_anon(rb)) {
+                continue;
+            }
+            pages = ramblock_dirty_bitmap_clear_unpopulated_pages(rb, fd);
+            rs->migration_dirty_pages -= pages;
+            trace_ram_bitmap_clear_unpopulated_pages(rb->idstr, pages);
+        }
+    }
+    close(fd);
+}
+#endif
+
 static bool ram_init_bitmaps(RAMState *rs, Error **errp)
 {
     bool ret = true;
@@ -2799,6 +3359,13 @@ out_unlock:
      * containing all 1s to exclude any discarded pages from migration.
      */
     migration_bitmap_clear_discarded_pages(rs);
+#ifdef CONFIG_LINUX
+    /*
+     * Likewise, skip the pages the guest never touched, so that the first
+     * pass doesn't fault them in just to find out that they are zero.
+     */
+    migration_bitmap_clear_unpopulated_pages(rs);
+#endif
     return true;
 }
 
@@ -3059,6 +3626,9 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
 
     if (migrate_multifd()) {
         migration_ops->ram_save_target_page = ram_save_target_page_multifd;
+        if (migrate_multifd_parallel_scan() && !(*rsp)->multifd_scan) {
+            (*rsp)->multifd_scan = ram_multifd_scan_create();
+        }
     } else {
         migration_ops->ram_save_target_page = ram_save_target_page_legacy;
     }
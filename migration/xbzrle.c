@@ -15,9 +15,12 @@
 #include "qemu/host-utils.h"
 #include "xbzrle.h"
 
-#if defined(CONFIG_AVX512BW_OPT)
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 #include <immintrin.h>
 #include "host/cpuinfo.h"
+#endif
+
+#if defined(CONFIG_AVX512BW_OPT)
 
 static int __attribute__((target("avx512bw")))
 xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -137,19 +140,150 @@ xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
-static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
-                                    int slen, uint8_t *dst, int dlen);
+#endif
+
+#if defined(CONFIG_AVX2_OPT)
+int __attribute__((target("avx2")))
+xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                          uint8_t *dst, int dlen)
+{
+    uint32_t zrun_len = 0, nzrun_len = 0;
+    int d = 0, i = 0, num = 0;
+    uint8_t *nzrun_start = NULL;
+    /* add 1 to include residual part in main loop */
+    uint32_t count256s = (slen >> 5) + 1;
+    /* countResidual is tail of data, i.e., countResidual = slen % 32 */
+    uint32_t count_residual = slen & 0b11111;
+    bool never_same = true;
+
+    while (count256s) {
+        int bytes_to_check = 32;
+        uint32_t comp = 0;
+        if (count256s == 1) {
+            /* No masked byte loads in AVX2, compare the tail by hand */
+            int j;
+
+            bytes_to_check = count_residual;
+            for (j = 0; j < count_residual; j++) {
+                comp |= (uint32_t)(old_buf[i + j] == new_buf[i + j]) << j;
+            }
+        } else {
+            __m256i old_data = _mm256_loadu_si256((__m256i *)(old_buf + i));
+            __m256i new_data = _mm256_loadu_si256((__m256i *)(new_buf + i));
+            comp = _mm256_movemask_epi8(_mm256_cmpeq_epi8(old_data,
+                                                          new_data));
+        }
+        count256s--;
+
+        bool is_same = (comp & 0x1);
+        while (bytes_to_check) {
+            if (d + 2 > dlen) {
+                return -1;
+            }
+            if (is_same) {
+                if (nzrun_len) {
+                    d += uleb128_encode_small(dst + d, nzrun_len);
+                    if (d + nzrun_len > dlen) {
+                        return -1;
+                    }
+                    nzrun_start = new_buf + i - nzrun_len;
+                    memcpy(dst + d, nzrun_start, nzrun_len);
+                    d += nzrun_len;
+                    nzrun_len = 0;
+                }
+                /* 32 data at a time for speed */
+                if (count256s && (comp == 0xffffffff)) {
+                    i += 32;
+                    zrun_len += 32;
+                    break;
+                }
+                never_same = false;
+                num = ctz32(~comp);
+                num = (num < bytes_to_check) ? num : bytes_to_check;
+                zrun_len += num;
+                bytes_to_check -= num;
+                comp >>= num;
+                i += num;
+                if (bytes_to_check) {
+                    /* still has different data after same data */
+                    d += uleb128_encode_small(dst + d, zrun_len);
+                    zrun_len = 0;
+                } else {
+                    break;
+                }
+            }
+            if (never_same || zrun_len) {
+                /*
+                 * never_same only acts if
+                 * data begins with diff in first count256s
+                 */
+                d += uleb128_encode_small(dst + d, zrun_len);
+                zrun_len = 0;
+                never_same = false;
+            }
+            /* has diff, 32 data at a time for speed */
+            if ((bytes_to_check == 32) && (comp == 0x0)) {
+                i += 32;
+                nzrun_len += 32;
+                break;
+            }
+            num = ctz32(comp);
+            num = (num < bytes_to_check) ? num : bytes_to_check;
+            nzrun_len += num;
+            bytes_to_check -= num;
+            comp >>= num;
+            i += num;
+            if (bytes_to_check) {
+                /* mask like 111000 */
+                d += uleb128_encode_small(dst + d, nzrun_len);
+                /* overflow */
+                if (d + nzrun_len > dlen) {
+                    return -1;
+                }
+                nzrun_start = new_buf + i - nzrun_len;
+                memcpy(dst + d, nzrun_start, nzrun_len);
+                d += nzrun_len;
+                nzrun_len = 0;
+                is_same = true;
+            }
+        }
+    }
+
+    if (nzrun_len != 0) {
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        nzrun_start = new_buf + i - nzrun_len;
+        memcpy(dst + d, nzrun_start, nzrun_len);
+        d += nzrun_len;
+    }
+    return d;
+}
+
+#endif
 
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
 static int (*accel_func)(uint8_t *, uint8_t *, int, uint8_t *, int);
 
 static void __attribute__((constructor)) init_accel(void)
 {
     unsigned info = cpuinfo_init();
+
+#if defined(CONFIG_AVX512BW_OPT)
     if (info & CPUINFO_AVX512BW) {
         accel_func = xbzrle_encode_buffer_avx512;
-    } else {
-        accel_func = xbzrle_encode_buffer_int;
+        return;
     }
+#endif
+#if defined(CONFIG_AVX2_OPT)
+    if (info & CPUINFO_AVX2) {
+        accel_func = xbzrle_encode_buffer_avx2;
+        return;
+    }
+#endif
+    accel_func = xbzrle_encode_buffer_int;
 }
 
 int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
@@ -19,4 +19,19 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
 
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen);
 
+#if defined(CONFIG_AVX512BW_OPT) || defined(CONFIG_AVX2_OPT)
+/*
+ * The generic encoder, which xbzrle_encode_buffer() uses if the host
+ * lacks the instructions for the accelerated ones.
+ */
+int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                             uint8_t *dst, int dlen);
+#endif
+
+#if defined(CONFIG_AVX2_OPT)
+/* Requires CPUINFO_AVX2 */
+int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                              uint8_t *dst, int dlen);
+#endif
+
 #endif
@@ -77,6 +77,35 @@ static int system_errno_to_nbd_errno(int err)
 
 /* Definitions for opaque data types */
 
+/* Read payloads smaller than this are always copied into the socket */
+#define NBD_ZERO_COPY_MIN_BYTES (16 * KiB)
+
+/*
+ * A request buffer that was freed while it may still be referenced by a
+ * zero copy send; it can be reused when @seq sends have completed
+ */
+typedef struct NBDZeroCopyBuf {
+    void *data;
+    ssize_t seq;
+    QSIMPLEQ_ENTRY(NBDZeroCopyBuf) next;
+} NBDZeroCopyBuf;
+
+typedef QSIMPLEQ_HEAD(, NBDZeroCopyBuf) NBDZeroCopyBufList;
+
+/* How often the buffers of closed clients are checked for completion */
+#define NBD_ZERO_COPY_REAP_INTERVAL_MS 100
+
+/*
+ * The request buffers of a closed client that still have zero copy sends
+ * in flight.  The socket is kept open until they have completed, so that
+ * their notifications can still be read.
+ */
+typedef struct NBDZeroCopyReaper {
+    QIOChannelSocket *sioc;
+    NBDZeroCopyBufList bufs;
+    QEMUTimer *timer;
+} NBDZeroCopyReaper;
+
 typedef struct NBDRequestData NBDRequestData;
 
 struct NBDRequestData {
@@ -101,6 +130,11 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    /* Next of common.iothread_ctxs to assign a connection to */
+    size_t next_iothread;
+
+    bool zero_copy_send;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -129,6 +163,11 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    /*
+     * AioContext in which requests are processed if the export has
+     * iothreads, NULL to follow the export's AioContext
+     */
+    AioContext *ctx;
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     uint32_t handshake_max_secs;
@@ -140,6 +179,10 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /* Send large read payloads with MSG_ZEROCOPY, until pinning fails */
+    bool zero_copy;
+    NBDZeroCopyBufList zero_copy_bufs; /* protected by lock */
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -159,6 +202,29 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/* Called once negotiation selected @exp for @client */
+static void nbd_export_add_client(NBDExport *exp, NBDClient *client)
+{
+    client->exp = exp;
+    if (exp->common.num_iothread_ctxs) {
+        client->ctx = exp->common.iothread_ctxs[exp->next_iothread];
+        exp->next_iothread = (exp->next_iothread + 1) %
+                             exp->common.num_iothread_ctxs;
+    }
+    /* With TLS, the payload is encrypted into a separate buffer anyway */
+    if (exp->zero_copy_send && client->ioc == QIO_CHANNEL(client->sioc)) {
+        client->zero_copy = qio_channel_socket_enable_zero_copy(client->sioc);
+        trace_nbd_client_zero_copy(client, client->zero_copy);
+    }
+    QTAILQ_INSERT_TAIL(&exp->clients, client, next);
+    blk_exp_ref(&exp->common);
+}
+
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: nbd_export_aio_context(client->exp);
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -536,8 +602,7 @@ nbd_negotiate_handle_export_name(NBDClient *client, bool no_zeroes,
         return ret;
     }
 
-    QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-    blk_exp_ref(&client->exp->common);
+    nbd_export_add_client(client->exp, client);
 
     return 0;
 }
@@ -750,10 +815,8 @@ nbd_negotiate_handle_info(NBDClient *client, Error **errp)
     }
 
     if (client->opt == NBD_OPT_GO) {
-        client->exp = exp;
         client->check_align = check_align;
-        QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-        blk_exp_ref(&client->exp->common);
+        nbd_export_add_client(exp, client);
         rc = 1;
     }
     return rc;
@@ -1433,6 +1496,97 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
     return 0;
 }
 
+/*
+ * Free the buffers on @bufs whose zero copy sends have completed according
+ * to @sioc->zero_copy_sent.
+ */
+static void nbd_zero_copy_bufs_free(QIOChannelSocket *sioc,
+                                    NBDZeroCopyBufList *bufs)
+{
+    NBDZeroCopyBuf *buf;
+
+    while ((buf = QSIMPLEQ_FIRST(bufs)) && buf->seq <= sioc->zero_copy_sent) {
+        QSIMPLEQ_REMOVE_HEAD(bufs, next);
+        qemu_vfree(buf->data);
+        g_free(buf);
+    }
+}
+
+/*
+ * Process the zero copy notifications that are available without blocking
+ * and free the request buffers whose sends have completed.
+ * Runs in the client's AioContext.
+ *
+ * Returns 0 on success, -1 on error (errp is set)
+ */
+static int nbd_client_reap_zero_copy(NBDClient *client, Error **errp)
+{
+    QIOChannelSocket *sioc = client->sioc;
+
+    if (sioc->zero_copy_sent == sioc->zero_copy_queued) {
+        return 0;
+    }
+
+    if (qio_channel_socket_zero_copy_poll(sioc, errp) < 0) {
+        return -1;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        nbd_zero_copy_bufs_free(sioc, &client->zero_copy_bufs);
+    }
+    return 0;
+}
+
+static void nbd_zero_copy_reaper_cb(void *opaque)
+{
+    NBDZeroCopyReaper *reaper = opaque;
+    Error *local_err = NULL;
+
+    if (qio_channel_socket_zero_copy_poll(reaper->sioc, &local_err) < 0) {
+        /*
+         * Completions can't be tracked anymore.  Leak the buffers rather
+         * than risk that reused memory is sent to the peer.
+         */
+        error_reportf_err(local_err,
+                          "Leaking NBD zero copy buffers, because: ");
+        QSIMPLEQ_INIT(&reaper->bufs);
+    }
+
+    nbd_zero_copy_bufs_free(reaper->sioc, &reaper->bufs);
+    trace_nbd_zero_copy_reaper(reaper->sioc, reaper->sioc->zero_copy_sent,
+                               reaper->sioc->zero_copy_queued);
+    if (!QSIMPLEQ_EMPTY(&reaper->bufs)) {
+        timer_mod(reaper->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  NBD_ZERO_COPY_REAP_INTERVAL_MS);
+        return;
+    }
+
+    timer_free(reaper->timer);
+    object_unref(OBJECT(reaper->sioc));
+    g_free(reaper);
+}
+
+/*
+ * Take over the request buffers on @bufs from a closed client.  The kernel
+ * may still reference them in queued skbs, so they are only freed once all
+ * of their zero copy sends have completed.  Runs in the main loop thread.
+ */
+static void nbd_zero_copy_reaper_start(QIOChannelSocket *sioc,
+                                       NBDZeroCopyBufList *bufs)
+{
+    NBDZeroCopyReaper *reaper = g_new0(NBDZeroCopyReaper, 1);
+
+    reaper->sioc = sioc;
+    object_ref(OBJECT(sioc));
+    QSIMPLEQ_INIT(&reaper->bufs);
+    QSIMPLEQ_CONCAT(&reaper->bufs, bufs);
+    reaper->timer = aio_timer_new(qemu_get_aio_context(),
+                                  QEMU_CLOCK_REALTIME, SCALE_MS,
+                                  nbd_zero_copy_reaper_cb, reaper);
+
+    nbd_zero_copy_reaper_cb(reaper);
+}
+
 /* nbd_read_eof
  * Tries to read @size bytes from @ioc. This is a local implementation of
  * qio_channel_readv_all_eof. We have it here because we need it to be
@@ -1453,6 +1607,14 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
 
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
+            /*
+             * Pending zero copy notifications make the socket report
+             * G_IO_ERR, which wakes us up below.  Consume them first so
+             * that waiting for input doesn't become busy polling.
+             */
+            if (nbd_client_reap_zero_copy(client, errp) < 0) {
+                return -EIO;
+            }
             WITH_QEMU_LOCK_GUARD(&client->lock) {
                 client->read_yielding = true;
 
@@ -1546,7 +1708,7 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
-/* Runs in export AioContext and main loop thread */
+/* Runs in the client's AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
     qatomic_inc(&client->refcount);
@@ -1573,6 +1735,9 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        if (!QSIMPLEQ_EMPTY(&client->zero_copy_bufs)) {
+            nbd_zero_copy_reaper_start(client->sioc, &client->zero_copy_bufs);
+        }
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1627,7 +1792,7 @@ static void client_close(NBDClient *client, bool negotiated)
     }
 }
 
-/* Runs in export AioContext with client->lock held */
+/* Runs in the client's AioContext with client->lock held */
 static NBDRequestData *nbd_request_get(NBDClient *client)
 {
     NBDRequestData *req;
@@ -1640,15 +1805,24 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     return req;
 }
 
-/* Runs in export AioContext with client->lock held */
+/* Runs in the client's AioContext with client->lock held */
 static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->data &&
+        client->sioc->zero_copy_sent < client->sioc->zero_copy_queued) {
+        /* The kernel may still be sending from the buffer */
+        NBDZeroCopyBuf *buf = g_new(NBDZeroCopyBuf, 1);
+
+        buf->data = req->data;
+        buf->seq = client->sioc->zero_copy_queued;
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_bufs, buf, next);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
+    nbd_zero_copy_bufs_free(client->sioc, &client->zero_copy_bufs);
 
     client->nb_requests--;
 
@@ -1719,7 +1893,7 @@ static void nbd_drained_end(void *opaque)
     }
 }
 
-/* Runs in export AioContext */
+/* Runs in the client's AioContext */
 static void nbd_wake_read_bh(void *opaque)
 {
     NBDClient *client = opaque;
@@ -1740,12 +1914,12 @@ static bool nbd_drained_poll(void *opaque)
                  * If there's a coroutine waiting for a request on nbd_read_eof()
                  * enter it here so we don't depend on the client to wake it up.
                  *
-                 * Schedule a BH in the export AioContext to avoid missing the
-                 * wake up due to the race between qio_channel_wake_read() and
-                 * qio_channel_yield().
+                 * Schedule a BH in the client's AioContext to avoid missing
+                 * the wake up due to the race between qio_channel_wake_read()
+                 * and qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1923,6 +2097,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy_send = arg->zero_copy_send;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2018,11 +2193,71 @@ static void nbd_export_delete(BlockExport *blk_exp)
 const BlockExportDriver blk_exp_nbd = {
     .type               = BLOCK_EXPORT_TYPE_NBD,
     .instance_size      = sizeof(NBDExport),
+    .supports_iothreads = true,
     .create             = nbd_export_create,
     .delete             = nbd_export_delete,
     .request_shutdown   = nbd_export_request_shutdown,
 };
 
+/*
+ * Write all of @iov to the client.  This is a local implementation of
+ * qio_channel_writev_full_all(), because zero copy notifications must be
+ * reaped before waiting for G_IO_OUT: They make the socket report G_IO_ERR,
+ * so the wait would return immediately.
+ * Called with client->send_lock held.
+ *
+ * Returns 0 on success, -1 on error (errp is set)
+ */
+static int coroutine_fn nbd_co_writev_all(NBDClient *client,
+                                          struct iovec *iov, unsigned niov,
+                                          int flags, Error **errp)
+{
+    g_autofree struct iovec *local_iov_head = g_new(struct iovec, niov);
+    struct iovec *local_iov = local_iov_head;
+    unsigned int nlocal_iov;
+
+    nlocal_iov = iov_copy(local_iov, niov, iov, niov, 0, iov_size(iov, niov));
+
+    while (nlocal_iov > 0) {
+        Error *local_err = NULL;
+        ssize_t len;
+
+        if (!client->zero_copy) {
+            flags &= ~QIO_CHANNEL_WRITE_FLAG_ZERO_COPY;
+        }
+
+        len = qio_channel_writev_full(client->ioc, local_iov, nlocal_iov,
+                                      NULL, 0, flags, &local_err);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            if (nbd_client_reap_zero_copy(client, errp) < 0) {
+                return -1;
+            }
+            qio_channel_yield(client->ioc, G_IO_OUT);
+            continue;
+        }
+        if (len < 0) {
+            /*
+             * ENOBUFS means that the pinned pages would exceed
+             * RLIMIT_MEMLOCK, and that nothing was sent.  Copy the rest of
+             * this payload and all later ones instead of failing requests.
+             */
+            if (!(flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) ||
+                errno != ENOBUFS) {
+                error_propagate(errp, local_err);
+                return -1;
+            }
+            error_free(local_err);
+            client->zero_copy = false;
+            trace_nbd_client_zero_copy(client, false);
+            continue;
+        }
+
+        iov_discard_front(&local_iov, &nlocal_iov, len);
+    }
+
+    return nbd_client_reap_zero_copy(client, errp);
+}
+
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
                                         unsigned niov, Error **errp)
 {
@@ -2032,7 +2267,7 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     qemu_co_mutex_lock(&client->send_lock);
     client->send_coroutine = qemu_coroutine_self();
 
-    ret = qio_channel_writev_all(client->ioc, iov, niov, errp) < 0 ? -EIO : 0;
+    ret = nbd_co_writev_all(client, iov, niov, 0, errp) < 0 ? -EIO : 0;
 
     client->send_coroutine = NULL;
     qemu_co_mutex_unlock(&client->send_lock);
@@ -2040,6 +2275,38 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Send @iov like nbd_co_send_iov(), but the last element is a read payload in
+ * the request buffer.  That buffer is only released by nbd_request_put(),
+ * which makes it possible to send large payloads with MSG_ZEROCOPY.
+ */
+static int coroutine_fn nbd_co_send_iov_payload(NBDClient *client,
+                                                struct iovec *iov,
+                                                unsigned niov, Error **errp)
+{
+    int ret;
+
+    if (!client->zero_copy || iov[niov - 1].iov_len < NBD_ZERO_COPY_MIN_BYTES) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /* The socket is corked, so the headers still go out with the payload */
+    ret = nbd_co_writev_all(client, iov, niov - 1, 0, errp);
+    if (ret == 0) {
+        ret = nbd_co_writev_all(client, &iov[niov - 1], 1,
+                                QIO_CHANNEL_WRITE_FLAG_ZERO_COPY, errp);
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2071,7 +2338,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_payload(client, iov, 2, errp);
 }
 
 /*
@@ -2152,7 +2419,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_payload(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -3170,7 +3437,7 @@ disconnect:
 }
 
 /*
- * Runs in export AioContext and main loop thread. Caller must hold
+ * Runs in the client's AioContext and main loop thread. Caller must hold
  * client->lock.
  */
 static void nbd_client_receive_next_request(NBDClient *client)
@@ -3182,7 +3449,7 @@ static void nbd_client_receive_next_request(NBDClient *client)
         nbd_client_get(client);
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client), client->recv_coroutine);
     }
 }
 
@@ -3263,6 +3530,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
     object_ref(OBJECT(client->sioc));
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
+    QSIMPLEQ_INIT(&client->zero_copy_bufs);
     client->close_fn = close_fn;
     client->owner = owner;
 
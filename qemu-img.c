@@ -1664,7 +1664,7 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
+#define MAX_COROUTINES 64
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
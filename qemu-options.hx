@@ -1462,6 +1462,19 @@ SRST
             supporting platforms, and 0 on other platforms. Setting it
             to 0 disables this feature.
 
+        ``alloc-reservation-size``
+            Allocate clusters for guest data in chunks of this size and
+            hand them out to subsequent allocating writes, so that the
+            refcount blocks need to be updated less often. Clusters that
+            are still reserved if QEMU exits unexpectedly are leaked.
+            The default value is 0, which disables this feature.
+
+        ``compressed-cache-size``
+            The maximum size of the cache of decompressed clusters. On a
+            cache miss, the compressed data that follows the requested
+            cluster is read ahead as well. Setting it to 0 disables both
+            (default: 0).
+
         ``pass-discard-request``
             Whether discard requests to the qcow2 device should be
             forwarded to the data source (on/off; default: on if
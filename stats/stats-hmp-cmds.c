@@ -91,6 +91,9 @@ static void print_stats_results(Monitor *mon, StatsTarget target,
         monitor_printf(mon, "provider: %s\n",
                        StatsProvider_str(result->provider));
     }
+    if (result->node_name) {
+        monitor_printf(mon, "node: %s\n", result->node_name);
+    }
 
     for (stats_list = result->stats; stats_list;
              stats_list = stats_list->next,
@@ -156,6 +159,7 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
         break;
     }
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK_NODE:
         break;
     default:
         break;
@@ -229,6 +233,7 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_BLOCK_NODE:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
@@ -66,6 +66,15 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         break;
     case STATS_TARGET_CRYPTODEV:
         break;
+    case STATS_TARGET_BLOCK_NODE:
+        if (filter->u.block_node.has_node_names) {
+            if (!filter->u.block_node.node_names) {
+                /* No targets allowed?  Return no statistics.  */
+                return true;
+            }
+            targets = filter->u.block_node.node_names;
+        }
+        break;
     default:
         abort();
     }
@@ -1356,6 +1356,24 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *
+test_migrate_postcopy_prefetch_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_int(to, "postcopy-prefetch-pages", 16);
+
+    return NULL;
+}
+
+static void test_postcopy_preempt_prefetch(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = test_migrate_postcopy_prefetch_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -1997,6 +2015,31 @@ static void test_precopy_unix_plain(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_skip_unpopulated_ram_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_bool(from, "skip-unpopulated-ram", true);
+
+    return NULL;
+}
+
+static void test_precopy_unix_skip_unpopulated_ram(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .listen_uri = uri,
+        .connect_uri = uri,
+        .start_hook = test_migrate_skip_unpopulated_ram_start,
+        /*
+         * The guest only touches part of its RAM, and keeps dirtying it
+         * while the rest is skipped.
+         */
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_unix_suspend_live(void)
 {
     g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
@@ -2160,6 +2203,33 @@ static void test_precopy_unix_xbzrle(void)
     test_precopy_common(&args);
 }
 
+static void *
+test_migrate_dirty_sync_threads_start(QTestState *from,
+                                      QTestState *to)
+{
+    migrate_set_parameter_int(from, "dirty-sync-threads", 4);
+
+    return NULL;
+}
+
+static void test_precopy_unix_dirty_sync_threads(void)
+{
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = uri,
+        .start_hook = test_migrate_dirty_sync_threads_start,
+        /*
+         * Every round starts with a sync, so run several of them while
+         * the guest keeps dirtying pages.
+         */
+        .iterations = 3,
+        .live = true,
+    };
+
+    test_precopy_common(&args);
+}
+
 static void test_precopy_file(void)
 {
     g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
@@ -2970,6 +3040,15 @@ test_migration_precopy_tcp_multifd_start_no_zero_page(QTestState *from,
     return NULL;
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_parallel_scan_start(QTestState *from,
+                                                     QTestState *to)
+{
+    migrate_set_parameter_bool(from, "multifd-parallel-scan", true);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "none");
+}
+
 static void *
 test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
                                             QTestState *to)
@@ -2984,6 +3063,15 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -3058,6 +3146,21 @@ static void test_multifd_tcp_no_zero_page(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_parallel_scan(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_parallel_scan_start,
+        /*
+         * The channels search and clear the dirty bitmap themselves, so
+         * run several rounds while the guest keeps dirtying pages.
+         */
+        .iterations = 3,
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 static void test_multifd_tcp_channels_none(void)
 {
     MigrateCommon args = {
@@ -3082,6 +3185,21 @@ static void test_multifd_tcp_zlib(void)
     test_precopy_common(&args);
 }
 
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        .iterations = 2,
+        /*
+         * XBZRLE needs pages to be modified when doing the 2nd+ round
+         * iteration to have real data pushed to the stream.
+         */
+        .live = true,
+    };
+    test_precopy_common(&args);
+}
+
 #ifdef CONFIG_ZSTD
 static void test_multifd_tcp_zstd(void)
 {
@@ -3840,6 +3958,8 @@ int main(int argc, char **argv)
                            test_postcopy_recovery);
         migration_test_add("/migration/postcopy/preempt/plain",
                            test_postcopy_preempt);
+        migration_test_add("/migration/postcopy/preempt/prefetch",
+                           test_postcopy_preempt_prefetch);
         migration_test_add("/migration/postcopy/preempt/recovery/plain",
                            test_postcopy_preempt_recovery);
         migration_test_add("/migration/postcopy/recovery/double-failures/handshake",
@@ -3854,8 +3974,12 @@ int main(int argc, char **argv)
 
     migration_test_add("/migration/precopy/unix/plain",
                        test_precopy_unix_plain);
+    migration_test_add("/migration/precopy/unix/skip-unpopulated-ram",
+                       test_precopy_unix_skip_unpopulated_ram);
     migration_test_add("/migration/precopy/unix/xbzrle",
                        test_precopy_unix_xbzrle);
+    migration_test_add("/migration/precopy/unix/dirty-sync-threads",
+                       test_precopy_unix_dirty_sync_threads);
     migration_test_add("/migration/precopy/file",
                        test_precopy_file);
     migration_test_add("/migration/precopy/file/offset",
@@ -3988,10 +4112,14 @@ int main(int argc, char **argv)
                        test_multifd_tcp_zero_page_legacy);
     migration_test_add("/migration/multifd/tcp/plain/zero-page/none",
                        test_multifd_tcp_no_zero_page);
+    migration_test_add("/migration/multifd/tcp/plain/parallel-scan",
+                       test_multifd_tcp_parallel_scan);
     migration_test_add("/migration/multifd/tcp/plain/cancel",
                        test_multifd_tcp_cancel);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
                        test_multifd_tcp_zlib);
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
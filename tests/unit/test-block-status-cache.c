@@ -0,0 +1,324 @@
+/*
+ * Block-status cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+
+#define TEST_IMAGE_SIZE (64 * 1024 * 1024)
+
+/* Number of times the driver was asked for the block status */
+static int block_status_calls;
+
+static int coroutine_fn bdrv_test_co_preadv(BlockDriverState *bs,
+                                            int64_t offset, int64_t bytes,
+                                            QEMUIOVector *qiov,
+                                            BdrvRequestFlags flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwritev(BlockDriverState *bs,
+                                             int64_t offset, int64_t bytes,
+                                             QEMUIOVector *qiov,
+                                             BdrvRequestFlags flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_block_status(BlockDriverState *bs,
+                                                  bool want_zero,
+                                                  int64_t offset, int64_t count,
+                                                  int64_t *pnum, int64_t *map,
+                                                  BlockDriverState **file)
+{
+    block_status_calls++;
+    *pnum = count;
+    return 0;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name            = "test",
+    .instance_size          = 1,
+    .supports_backing       = true,
+
+    .bdrv_co_preadv         = bdrv_test_co_preadv,
+    .bdrv_co_pwritev        = bdrv_test_co_pwritev,
+    .bdrv_co_block_status   = bdrv_test_co_block_status,
+};
+
+static BlockDriverState *test_node_new(void)
+{
+    BlockDriverState *bs;
+
+    bs = bdrv_new_open_driver(&bdrv_test, "test", BDRV_O_RDWR, &error_abort);
+    bs->total_sectors = TEST_IMAGE_SIZE / BDRV_SECTOR_SIZE;
+    return bs;
+}
+
+static void test_fill_unallocated(BlockDriverState *bs, int64_t offset,
+                                  int64_t bytes)
+{
+    bdrv_bsc_fill_unallocated(bs, offset, bytes, bdrv_bsc_generation(bs));
+}
+
+static void assert_data(BlockDriverState *bs, int64_t offset,
+                        int64_t expected_pnum)
+{
+    int64_t pnum = -1;
+
+    g_assert_true(bdrv_bsc_is_data(bs, offset, &pnum));
+    g_assert_cmpint(pnum, ==, expected_pnum);
+    g_assert_false(bdrv_bsc_is_unallocated(bs, offset, NULL));
+}
+
+static void assert_unallocated(BlockDriverState *bs, int64_t offset,
+                               int64_t expected_pnum)
+{
+    int64_t pnum = -1;
+
+    g_assert_true(bdrv_bsc_is_unallocated(bs, offset, &pnum));
+    g_assert_cmpint(pnum, ==, expected_pnum);
+    g_assert_false(bdrv_bsc_is_data(bs, offset, NULL));
+}
+
+static void assert_uncached(BlockDriverState *bs, int64_t offset)
+{
+    int64_t pnum = -1;
+
+    g_assert_false(bdrv_bsc_is_data(bs, offset, &pnum));
+    g_assert_false(bdrv_bsc_is_unallocated(bs, offset, &pnum));
+    g_assert_cmpint(pnum, ==, -1);
+}
+
+static void test_lookup(void)
+{
+    BlockDriverState *bs = test_node_new();
+
+    assert_uncached(bs, 0);
+
+    bdrv_bsc_fill(bs, 4096, 8192);
+    test_fill_unallocated(bs, 65536, 4096);
+
+    assert_uncached(bs, 0);
+    assert_uncached(bs, 4095);
+    assert_data(bs, 4096, 8192);
+    assert_data(bs, 8192, 4096);
+    assert_data(bs, 12287, 1);
+    assert_uncached(bs, 12288);
+
+    assert_uncached(bs, 65535);
+    assert_unallocated(bs, 65536, 4096);
+    assert_unallocated(bs, 69631, 1);
+    assert_uncached(bs, 69632);
+
+    bdrv_unref(bs);
+}
+
+static void test_insert_merge(void)
+{
+    BlockDriverState *bs = test_node_new();
+
+    /* Overlapping regions of the same type */
+    bdrv_bsc_fill(bs, 0, 8192);
+    bdrv_bsc_fill(bs, 4096, 8192);
+    assert_data(bs, 0, 12288);
+
+    /* A region that is contained in an existing one */
+    bdrv_bsc_fill(bs, 1024, 1024);
+    assert_data(bs, 0, 12288);
+
+    /* Adjacent regions of the same type, on both sides */
+    bdrv_bsc_fill(bs, 16384, 4096);
+    bdrv_bsc_fill(bs, 12288, 4096);
+    assert_data(bs, 0, 20480);
+    assert_data(bs, 16384, 4096);
+
+    /* One region that covers several others */
+    test_fill_unallocated(bs, 32768, 4096);
+    test_fill_unallocated(bs, 40960, 4096);
+    test_fill_unallocated(bs, 49152, 4096);
+    test_fill_unallocated(bs, 36864, 16384);
+    assert_unallocated(bs, 32768, 20480);
+
+    /* Adjacent regions of a different type stay separate */
+    bdrv_bsc_fill(bs, 53248, 4096);
+    assert_unallocated(bs, 32768, 20480);
+    assert_data(bs, 53248, 4096);
+
+    bdrv_unref(bs);
+}
+
+static void test_insert_replace(void)
+{
+    BlockDriverState *bs = test_node_new();
+
+    bdrv_bsc_fill(bs, 0, 16384);
+    test_fill_unallocated(bs, 32768, 16384);
+
+    /*
+     * A region of the other type drops the overlapping regions entirely,
+     * even the parts it does not cover
+     */
+    test_fill_unallocated(bs, 12288, 8192);
+    assert_uncached(bs, 0);
+    assert_uncached(bs, 8192);
+    assert_unallocated(bs, 12288, 8192);
+
+    bdrv_bsc_fill(bs, 40960, 4096);
+    assert_uncached(bs, 32768);
+    assert_data(bs, 40960, 4096);
+    assert_uncached(bs, 45056);
+
+    bdrv_unref(bs);
+}
+
+static void test_invalidate(void)
+{
+    BlockDriverState *bs = test_node_new();
+
+    bdrv_bsc_fill(bs, 0, 8192);
+    test_fill_unallocated(bs, 16384, 8192);
+    bdrv_bsc_fill(bs, 32768, 8192);
+
+    /* Disjoint ranges do not touch the cache */
+    bdrv_bsc_invalidate_range(bs, 8192, 8192);
+    bdrv_bsc_invalidate_range(bs, 24576, 8192);
+    assert_data(bs, 0, 8192);
+    assert_unallocated(bs, 16384, 8192);
+    assert_data(bs, 32768, 8192);
+
+    /* A partial overlap drops the whole region */
+    bdrv_bsc_invalidate_range(bs, 20480, 512);
+    assert_data(bs, 0, 8192);
+    assert_uncached(bs, 16384);
+    assert_uncached(bs, 23552);
+    assert_data(bs, 32768, 8192);
+
+    /* Empty ranges are ignored */
+    bdrv_bsc_invalidate_range(bs, 0, 0);
+    assert_data(bs, 0, 8192);
+
+    /* INT64_MAX covers everything from the offset on */
+    bdrv_bsc_invalidate_range(bs, 4096, INT64_MAX);
+    assert_uncached(bs, 0);
+    assert_uncached(bs, 32768);
+
+    bdrv_unref(bs);
+}
+
+static void test_generation(void)
+{
+    BlockDriverState *bs = test_node_new();
+    unsigned int gen;
+
+    /*
+     * An invalidation between querying the driver and filling the cache
+     * means that the result may be stale already
+     */
+    gen = bdrv_bsc_generation(bs);
+    bdrv_bsc_invalidate_range(bs, 0, 4096);
+    g_assert_cmpuint(bdrv_bsc_generation(bs), !=, gen);
+    bdrv_bsc_fill_unallocated(bs, 0, 4096, gen);
+    assert_uncached(bs, 0);
+
+    /* Even if the cache was empty and the range did not overlap */
+    gen = bdrv_bsc_generation(bs);
+    bdrv_bsc_invalidate_range(bs, 65536, 4096);
+    bdrv_bsc_fill_unallocated(bs, 0, 4096, gen);
+    assert_uncached(bs, 0);
+
+    gen = bdrv_bsc_generation(bs);
+    bdrv_bsc_fill_unallocated(bs, 0, 4096, gen);
+    assert_unallocated(bs, 0, 4096);
+
+    /* Data regions do not depend on the generation */
+    bdrv_bsc_invalidate_range(bs, 0, 4096);
+    bdrv_bsc_fill(bs, 0, 4096);
+    assert_data(bs, 0, 4096);
+
+    bdrv_unref(bs);
+}
+
+static void test_overflow(void)
+{
+    BlockDriverState *bs = test_node_new();
+    int i;
+
+    /* Leave a gap between the regions so that they are not merged */
+    for (i = 0; i < 1024; i++) {
+        bdrv_bsc_fill(bs, i * 8192, 4096);
+    }
+    assert_data(bs, 0, 4096);
+    assert_data(bs, 1023 * 8192, 4096);
+
+    /* The cache starts over instead of growing further */
+    bdrv_bsc_fill(bs, 1024 * 8192, 4096);
+    assert_uncached(bs, 0);
+    assert_uncached(bs, 1023 * 8192);
+    assert_data(bs, 1024 * 8192, 4096);
+
+    bdrv_unref(bs);
+}
+
+static void test_block_status(void)
+{
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    int64_t pnum;
+    int ret;
+
+    blk = blk_new(qemu_get_aio_context(), BLK_PERM_ALL, BLK_PERM_ALL);
+    bs = test_node_new();
+    blk_insert_bs(blk, bs, &error_abort);
+    block_status_calls = 0;
+
+    /* The unallocated region is cached for nodes that support backing */
+    ret = bdrv_block_status(bs, 0, 65536, &pnum, NULL, NULL);
+    g_assert_cmpint(ret & BDRV_BLOCK_ALLOCATED, ==, 0);
+    g_assert_cmpint(pnum, ==, 65536);
+    g_assert_cmpint(block_status_calls, ==, 1);
+    assert_unallocated(bs, 0, 65536);
+
+    ret = bdrv_block_status(bs, 4096, 4096, &pnum, NULL, NULL);
+    g_assert_cmpint(ret & BDRV_BLOCK_ALLOCATED, ==, 0);
+    g_assert_cmpint(pnum, ==, 4096);
+    g_assert_cmpint(block_status_calls, ==, 1);
+
+    /* A write may allocate, so the driver must be asked again */
+    ret = blk_pwrite_zeroes(blk, 8192, 512, 0);
+    g_assert_cmpint(ret, ==, 0);
+    assert_uncached(bs, 0);
+
+    ret = bdrv_block_status(bs, 4096, 4096, &pnum, NULL, NULL);
+    g_assert_cmpint(pnum, ==, 4096);
+    g_assert_cmpint(block_status_calls, ==, 2);
+
+    blk_unref(blk);
+    bdrv_unref(bs);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-status-cache/lookup", test_lookup);
+    g_test_add_func("/block-status-cache/insert-merge", test_insert_merge);
+    g_test_add_func("/block-status-cache/insert-replace", test_insert_replace);
+    g_test_add_func("/block-status-cache/invalidate", test_invalidate);
+    g_test_add_func("/block-status-cache/generation", test_generation);
+    g_test_add_func("/block-status-cache/overflow", test_overflow);
+    g_test_add_func("/block-status-cache/block-status", test_block_status);
+
+    return g_test_run();
+}
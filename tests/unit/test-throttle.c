@@ -143,6 +143,40 @@ static void test_compute_wait(void)
     }
 }
 
+static void test_headroom(void)
+{
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = 100;
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* empty bucket */
+    g_assert(throttle_has_headroom(&ts, THROTTLE_READ));
+
+    /* without bkt.max the bucket size is avg / 10 = 10 operations */
+    ts.cfg.buckets[THROTTLE_OPS_TOTAL].level = 5;
+    g_assert(throttle_has_headroom(&ts, THROTTLE_READ));
+    g_assert(throttle_has_headroom(&ts, THROTTLE_WRITE));
+    ts.cfg.buckets[THROTTLE_OPS_TOTAL].level = 6;
+    g_assert(!throttle_has_headroom(&ts, THROTTLE_READ));
+    g_assert(!throttle_has_headroom(&ts, THROTTLE_WRITE));
+
+    /* a full bucket in one direction doesn't affect the other one */
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_READ].avg = 100;
+    cfg.buckets[THROTTLE_OPS_WRITE].avg = 100;
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+    ts.cfg.buckets[THROTTLE_OPS_WRITE].level = 10;
+    g_assert(throttle_has_headroom(&ts, THROTTLE_READ));
+    g_assert(!throttle_has_headroom(&ts, THROTTLE_WRITE));
+
+    /* there is no credit in a direction without limits */
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_WRITE].avg = 100;
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+    g_assert(!throttle_has_headroom(&ts, THROTTLE_READ));
+    g_assert(throttle_has_headroom(&ts, THROTTLE_WRITE));
+}
+
 /* functions to test ThrottleState initialization/destroy methods */
 static void read_timer_cb(void *opaque)
 {
@@ -801,6 +835,220 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+/* functions to test parent groups and borrowing */
+#define GROUP_REQS 128
+
+typedef struct {
+    ThrottleGroupMember *tgm;
+    bool done;
+} GroupReq;
+
+static GroupReq group_reqs[GROUP_REQS];
+static int group_nr_reqs;
+
+static void coroutine_fn group_req_entry(void *opaque)
+{
+    GroupReq *req = opaque;
+
+    throttle_group_co_io_limits_intercept(req->tgm, 512, THROTTLE_READ);
+    req->done = true;
+}
+
+/* Submit @n reads through @tgm and return how many were not throttled */
+static int submit_reads(ThrottleGroupMember *tgm, int n)
+{
+    int i, done = 0;
+
+    g_assert(group_nr_reqs + n <= GROUP_REQS);
+    for (i = 0; i < n; i++) {
+        GroupReq *req = &group_reqs[group_nr_reqs++];
+
+        *req = (GroupReq) { .tgm = tgm };
+        qemu_coroutine_enter(qemu_coroutine_create(group_req_entry, req));
+        done += req->done;
+    }
+
+    return done;
+}
+
+/* Release all throttled reads and unregister @tgm */
+static void drain_reads(ThrottleGroupMember *tgm)
+{
+    bool busy;
+    int i;
+
+    qatomic_inc(&tgm->io_limits_disabled);
+    throttle_group_restart_tgm(tgm);
+    do {
+        busy = false;
+        for (i = 0; i < group_nr_reqs; i++) {
+            busy |= group_reqs[i].tgm == tgm && !group_reqs[i].done;
+        }
+        if (busy) {
+            aio_poll(ctx, true);
+        }
+    } while (busy);
+    qatomic_dec(&tgm->io_limits_disabled);
+
+    throttle_group_unregister_tgm(tgm);
+}
+
+/* Empty the buckets of the group of @tgm */
+static void reset_levels(ThrottleGroupMember *tgm)
+{
+    ThrottleConfig cfg1;
+
+    throttle_group_get_config(tgm, &cfg1);
+    throttle_group_config(tgm, &cfg1);
+}
+
+/*
+ * Create a throttle group with an iops-total limit of @iops (no limit if 0).
+ * Without bkt.max the bucket size is iops / 10, and a request is let through
+ * as long as the bucket is not over that size, so iops / 10 + 1 requests can
+ * be submitted at once.
+ */
+static Object *group_new(const char *name, int64_t iops, const char *parent,
+                         bool borrow, Error **errp)
+{
+    g_autofree char *iops_str = g_strdup_printf("%" PRId64, iops);
+
+    if (parent) {
+        return object_new_with_props(TYPE_THROTTLE_GROUP,
+                                     object_get_objects_root(), name, errp,
+                                     "x-iops-total", iops_str,
+                                     "parent-group", parent,
+                                     "borrow", borrow ? "on" : "off",
+                                     NULL);
+    }
+    return object_new_with_props(TYPE_THROTTLE_GROUP,
+                                 object_get_objects_root(), name, errp,
+                                 "x-iops-total", iops_str, NULL);
+}
+
+static void test_groups_parent(void)
+{
+    ThrottleGroupMember tgm1 = {}, tgm2 = {};
+    Object *parent, *child1, *child2;
+
+    group_nr_reqs = 0;
+    parent = group_new("tenant1", 20, NULL, false, &error_abort);
+    child1 = group_new("disk1", 1000, "tenant1", false, &error_abort);
+    child2 = group_new("disk2", 1000, "tenant1", false, &error_abort);
+
+    throttle_group_register_tgm(&tgm1, "disk1", ctx);
+    throttle_group_register_tgm(&tgm2, "disk2", ctx);
+
+    /* The parent limit applies to the child groups together */
+    g_assert_cmpint(submit_reads(&tgm1, 2), ==, 2);
+    g_assert_cmpint(submit_reads(&tgm2, 4), ==, 1);
+    g_assert_cmpint(submit_reads(&tgm1, 4), ==, 0);
+
+    drain_reads(&tgm1);
+    drain_reads(&tgm2);
+    object_unparent(child1);
+    object_unparent(child2);
+    object_unparent(parent);
+}
+
+static void test_groups_parent_reconfig(void)
+{
+    ThrottleGroupMember tgm_parent = {}, tgm1 = {}, tgm2 = {};
+    Object *parent, *child1, *child2;
+    ThrottleConfig cfg1;
+
+    group_nr_reqs = 0;
+    parent = group_new("tenant2", 10, NULL, false, &error_abort);
+    child1 = group_new("disk3", 1000, "tenant2", false, &error_abort);
+    child2 = group_new("disk4", 1000, "tenant2", false, &error_abort);
+
+    throttle_group_register_tgm(&tgm_parent, "tenant2", ctx);
+    throttle_group_register_tgm(&tgm1, "disk3", ctx);
+    throttle_group_register_tgm(&tgm2, "disk4", ctx);
+
+    /* Throttling disk3 caches a deadline in the parent for all children */
+    g_assert_cmpint(submit_reads(&tgm1, 3), ==, 2);
+
+    /* It must not outlive the limits it was computed for */
+    throttle_config_init(&cfg1);
+    cfg1.buckets[THROTTLE_OPS_TOTAL].avg = 1000;
+    throttle_group_config(&tgm_parent, &cfg1);
+    g_assert_cmpint(submit_reads(&tgm2, 4), ==, 4);
+
+    drain_reads(&tgm1);
+    drain_reads(&tgm2);
+    throttle_group_unregister_tgm(&tgm_parent);
+    object_unparent(child1);
+    object_unparent(child2);
+    object_unparent(parent);
+}
+
+static void test_groups_borrow(void)
+{
+    ThrottleGroupMember tgm_parent = {}, tgm1 = {}, tgm2 = {}, tgm3 = {};
+    Object *parent, *child1, *child2, *child3;
+    ThrottleConfig cfg1;
+
+    group_nr_reqs = 0;
+    parent = group_new("tenant3", 1000, NULL, false, &error_abort);
+    child1 = group_new("disk5", 10, "tenant3", true, &error_abort);
+    child2 = group_new("disk6", 10, "tenant3", false, &error_abort);
+    child3 = group_new("disk7", 10000, "tenant3", false, &error_abort);
+
+    throttle_group_register_tgm(&tgm_parent, "tenant3", ctx);
+    throttle_group_register_tgm(&tgm1, "disk5", ctx);
+    throttle_group_register_tgm(&tgm2, "disk6", ctx);
+    throttle_group_register_tgm(&tgm3, "disk7", ctx);
+
+    /* A borrowing group can use the parent's unused credit */
+    g_assert_cmpint(submit_reads(&tgm1, 20), ==, 20);
+    g_assert_cmpint(submit_reads(&tgm2, 20), ==, 2);
+    drain_reads(&tgm2);
+
+    /* Once the parent's bucket is more than half full, it can't anymore */
+    reset_levels(&tgm_parent);
+    reset_levels(&tgm1);
+    g_assert_cmpint(submit_reads(&tgm3, 60), ==, 60);
+    g_assert_cmpint(submit_reads(&tgm1, 4), ==, 2);
+    drain_reads(&tgm1);
+
+    /* Without limits in the parent, there is nothing to borrow */
+    throttle_config_init(&cfg1);
+    throttle_group_config(&tgm_parent, &cfg1);
+    throttle_group_register_tgm(&tgm1, "disk5", ctx);
+    reset_levels(&tgm1);
+    g_assert_cmpint(submit_reads(&tgm1, 4), ==, 2);
+
+    drain_reads(&tgm1);
+    drain_reads(&tgm3);
+    throttle_group_unregister_tgm(&tgm_parent);
+    object_unparent(child1);
+    object_unparent(child2);
+    object_unparent(child3);
+    object_unparent(parent);
+}
+
+static void test_groups_borrow_invalid(void)
+{
+    Error *local_err = NULL;
+    Object *parent;
+
+    /* 'borrow' needs a parent ... */
+    g_assert(!object_new_with_props(TYPE_THROTTLE_GROUP,
+                                    object_get_objects_root(), "disk8",
+                                    &local_err, "borrow", "on", NULL));
+    error_free_or_abort(&local_err);
+
+    /* ... with limits */
+    parent = group_new("tenant4", 0, NULL, false, &error_abort);
+    g_assert(!group_new("disk8", 10, "tenant4", true, &local_err));
+    error_free_or_abort(&local_err);
+
+    /* Without borrowing, a parent without limits is fine */
+    object_unparent(group_new("disk8", 10, "tenant4", false, &error_abort));
+    object_unparent(parent);
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -814,6 +1062,7 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/throttle/leak_bucket",        test_leak_bucket);
     g_test_add_func("/throttle/compute_wait",       test_compute_wait);
+    g_test_add_func("/throttle/headroom",           test_headroom);
     g_test_add_func("/throttle/init",               test_init);
     g_test_add_func("/throttle/init_readonly",      test_init_readonly);
     g_test_add_func("/throttle/init_writeonly",     test_init_writeonly);
@@ -830,6 +1079,12 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/parent",      test_groups_parent);
+    g_test_add_func("/throttle/groups/parent_reconfig",
+                    test_groups_parent_reconfig);
+    g_test_add_func("/throttle/groups/borrow",      test_groups_borrow);
+    g_test_add_func("/throttle/groups/borrow_invalid",
+                    test_groups_borrow_invalid);
     return g_test_run();
 }
 
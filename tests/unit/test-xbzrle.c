@@ -14,6 +14,10 @@
 #include "qemu/cutils.h"
 #include "../migration/xbzrle.h"
 
+#if defined(CONFIG_AVX2_OPT)
+#include "host/cpuinfo.h"
+#endif
+
 #define XBZRLE_PAGE_SIZE 4096
 
 static void test_uleb(void)
@@ -173,6 +177,82 @@ static void test_encode_decode(void)
     }
 }
 
+#if defined(CONFIG_AVX2_OPT)
+static void encode_compare_avx2(int slen)
+{
+    uint8_t *old_buf = g_malloc(slen);
+    uint8_t *new_buf = g_malloc(slen);
+    /* Large enough for any encoding, so that neither encoder overflows */
+    uint8_t *compressed = g_malloc(2 * slen);
+    uint8_t *compressed_avx2 = g_malloc(2 * slen);
+    uint8_t *test = g_malloc(slen);
+    int nr_runs = g_test_rand_int_range(0, 16);
+    int i, dlen, dlen_avx2, rc;
+
+    for (i = 0; i < slen; i++) {
+        old_buf[i] = g_test_rand_int();
+    }
+    memcpy(new_buf, old_buf, slen);
+
+    /* Changed runs of random length, which may overlap or touch the ends */
+    for (i = 0; i < nr_runs; i++) {
+        int start = g_test_rand_int_range(0, slen);
+        int len = g_test_rand_int_range(1, MIN(slen - start, 80) + 1);
+        int j;
+
+        for (j = start; j < start + len; j++) {
+            new_buf[j] = old_buf[j] + g_test_rand_int_range(1, 256);
+        }
+    }
+
+    dlen = xbzrle_encode_buffer_int(old_buf, new_buf, slen,
+                                    compressed, 2 * slen);
+    dlen_avx2 = xbzrle_encode_buffer_avx2(old_buf, new_buf, slen,
+                                          compressed_avx2, 2 * slen);
+    g_assert_cmpint(dlen, >=, 0);
+    g_assert_cmpint(dlen_avx2, ==, dlen);
+    g_assert(memcmp(compressed, compressed_avx2, dlen) == 0);
+
+    memcpy(test, old_buf, slen);
+    rc = xbzrle_decode_buffer(compressed_avx2, dlen_avx2, test, slen);
+    g_assert_cmpint(rc, >=, 0);
+    g_assert(memcmp(test, new_buf, slen) == 0);
+
+    /* A page that changed completely does not fit into a page */
+    for (i = 0; i < slen; i++) {
+        new_buf[i] = old_buf[i] + 1;
+    }
+    g_assert_cmpint(xbzrle_encode_buffer_int(old_buf, new_buf, slen,
+                                             compressed, slen), ==, -1);
+    g_assert_cmpint(xbzrle_encode_buffer_avx2(old_buf, new_buf, slen,
+                                              compressed_avx2, slen), ==, -1);
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(compressed);
+    g_free(compressed_avx2);
+    g_free(test);
+}
+
+static void test_encode_avx2(void)
+{
+    /* Not multiples of 32, to cover the tail that AVX2 compares by hand */
+    static const int slens[] = { 8, 24, 40, 1000, 4088, XBZRLE_PAGE_SIZE };
+    int i, j;
+
+    if (!(cpuinfo_init() & CPUINFO_AVX2)) {
+        g_test_skip("AVX2 not supported by the host");
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(slens); i++) {
+        for (j = 0; j < 1000; j++) {
+            encode_compare_avx2(slens[i]);
+        }
+    }
+}
+#endif
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -185,6 +265,9 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+#if defined(CONFIG_AVX2_OPT)
+    g_test_add_func("/xbzrle/encode_avx2", test_encode_avx2);
+#endif
 
     return g_test_run();
 }
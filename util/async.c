@@ -30,6 +30,7 @@
 #include "block/graph-lock.h"
 #include "qemu/main-loop.h"
 #include "qemu/atomic.h"
+#include "qemu/memalign.h"
 #include "qemu/rcu_queue.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine_int.h"
@@ -370,6 +371,10 @@ aio_ctx_finalize(GSource     *source)
 
     thread_pool_free(ctx->thread_pool);
 
+    while (ctx->nr_padding_bufs) {
+        qemu_vfree(ctx->padding_bufs[--ctx->nr_padding_bufs]);
+    }
+
 #ifdef CONFIG_LINUX_AIO
     if (ctx->linux_aio) {
         laio_detach_aio_context(ctx->linux_aio, ctx);
@@ -468,7 +473,8 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
         return ctx->linux_io_uring;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
+    ctx->linux_io_uring = luring_init(ctx->linux_io_uring_sqpoll,
+                                      ctx->linux_io_uring_sqpoll_cpu, errp);
     if (!ctx->linux_io_uring) {
         return NULL;
     }
@@ -602,6 +608,8 @@ AioContext *aio_context_new(Error **errp)
 
 #ifdef CONFIG_LINUX_IO_URING
     ctx->linux_io_uring = NULL;
+    ctx->linux_io_uring_sqpoll = false;
+    ctx->linux_io_uring_sqpoll_cpu = -1;
 #endif
 
     ctx->thread_pool = NULL;
@@ -758,3 +766,21 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
 }
+
+void aio_context_set_io_uring_params(AioContext *ctx, bool sqpoll,
+                                     int64_t sqpoll_cpu, Error **errp)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (sqpoll_cpu < -1 || sqpoll_cpu > INT_MAX) {
+        error_setg(errp, "bad io-uring-sqpoll-cpu value");
+        return;
+    }
+
+    ctx->linux_io_uring_sqpoll = sqpoll;
+    ctx->linux_io_uring_sqpoll_cpu = sqpoll_cpu;
+#else
+    if (sqpoll) {
+        error_setg(errp, "io-uring-sqpoll is not supported in this build");
+    }
+#endif
+}
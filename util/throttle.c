@@ -87,6 +87,29 @@ static int64_t throttle_do_compute_wait(double limit, double extra)
     return wait;
 }
 
+/* Compute the size of the buckets of a leaky bucket
+ *
+ * @bkt:               the leaky bucket we operate on
+ * @bucket_size:       I/O before throttling to bkt->avg
+ * @burst_bucket_size: I/O before throttling to bkt->max
+ */
+static void throttle_bucket_sizes(LeakyBucket *bkt, double *bucket_size,
+                                  double *burst_bucket_size)
+{
+    if (!bkt->max) {
+        /* If bkt->max is 0 we still want to allow short bursts of I/O
+         * from the guest, otherwise every other request will be throttled
+         * and performance will suffer considerably. */
+        *bucket_size = (double) bkt->avg / 10;
+        *burst_bucket_size = 0;
+    } else {
+        /* If we have a burst limit then we have to wait until all I/O
+         * at burst rate has finished before throttling to bkt->avg */
+        *bucket_size = bkt->max * bkt->burst_length;
+        *burst_bucket_size = (double) bkt->max / 10;
+    }
+}
+
 /* This function compute the wait time in ns that a leaky bucket should trigger
  *
  * @bkt: the leaky bucket we operate on
@@ -102,18 +125,7 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
         return 0;
     }
 
-    if (!bkt->max) {
-        /* If bkt->max is 0 we still want to allow short bursts of I/O
-         * from the guest, otherwise every other request will be throttled
-         * and performance will suffer considerably. */
-        bucket_size = (double) bkt->avg / 10;
-        burst_bucket_size = 0;
-    } else {
-        /* If we have a burst limit then we have to wait until all I/O
-         * at burst rate has finished before throttling to bkt->avg */
-        bucket_size = bkt->max * bkt->burst_length;
-        burst_bucket_size = (double) bkt->max / 10;
-    }
+    throttle_bucket_sizes(bkt, &bucket_size, &burst_bucket_size);
 
     /* If the main bucket is full then we have to wait */
     extra = bkt->level - bucket_size;
@@ -134,6 +146,14 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
     return 0;
 }
 
+/* The buckets that limit I/O in each direction */
+static const BucketType throttle_buckets_to_check[THROTTLE_MAX][4] = {
+    { THROTTLE_BPS_TOTAL, THROTTLE_OPS_TOTAL,
+      THROTTLE_BPS_READ, THROTTLE_OPS_READ },
+    { THROTTLE_BPS_TOTAL, THROTTLE_OPS_TOTAL,
+      THROTTLE_BPS_WRITE, THROTTLE_OPS_WRITE },
+};
+
 /* This function compute the time that must be waited while this IO
  *
  * @direction:  throttle direction
@@ -142,20 +162,11 @@ int64_t throttle_compute_wait(LeakyBucket *bkt)
 static int64_t throttle_compute_wait_for(ThrottleState *ts,
                                          ThrottleDirection direction)
 {
-    static const BucketType to_check[THROTTLE_MAX][4] = {
-                                  {THROTTLE_BPS_TOTAL,
-                                   THROTTLE_OPS_TOTAL,
-                                   THROTTLE_BPS_READ,
-                                   THROTTLE_OPS_READ},
-                                  {THROTTLE_BPS_TOTAL,
-                                   THROTTLE_OPS_TOTAL,
-                                   THROTTLE_BPS_WRITE,
-                                   THROTTLE_OPS_WRITE}, };
     int64_t wait, max_wait = 0;
     int i;
 
-    for (i = 0; i < ARRAY_SIZE(to_check[THROTTLE_READ]); i++) {
-        BucketType index = to_check[direction][i];
+    for (i = 0; i < ARRAY_SIZE(throttle_buckets_to_check[THROTTLE_READ]); i++) {
+        BucketType index = throttle_buckets_to_check[direction][i];
         wait = throttle_compute_wait(&ts->cfg.buckets[index]);
         if (wait > max_wait) {
             max_wait = wait;
@@ -165,6 +176,63 @@ static int64_t throttle_compute_wait_for(ThrottleState *ts,
     return max_wait;
 }
 
+/* Leak the buckets up to @now and compute the time that must be waited
+ * before doing I/O in @direction
+ *
+ * @direction:  throttle direction
+ * @now:        the current clock timestamp
+ * @ret:        time to wait in ns or 0 if the operation can go through
+ */
+int64_t throttle_compute_wait_at(ThrottleState *ts,
+                                 ThrottleDirection direction,
+                                 int64_t now)
+{
+    assert(direction < THROTTLE_MAX);
+
+    /* leak proportionally to the time elapsed */
+    throttle_do_leak(ts, now);
+
+    return throttle_compute_wait_for(ts, direction);
+}
+
+/* Check whether I/O in @direction is comfortably below the limits, i.e.
+ * whether all the buckets that apply to it are at most half full. The
+ * buckets must have been leaked recently, see throttle_compute_wait_at().
+ *
+ * @direction:  throttle direction
+ * @ret:        true if there is unused credit, false if it is used up or
+ *              if no limit applies to @direction
+ */
+bool throttle_has_headroom(ThrottleState *ts, ThrottleDirection direction)
+{
+    double bucket_size, burst_bucket_size;
+    bool limited = false;
+    int i;
+
+    assert(direction < THROTTLE_MAX);
+
+    for (i = 0; i < ARRAY_SIZE(throttle_buckets_to_check[THROTTLE_READ]); i++) {
+        BucketType index = throttle_buckets_to_check[direction][i];
+        LeakyBucket *bkt = &ts->cfg.buckets[index];
+
+        if (!bkt->avg) {
+            continue;
+        }
+
+        limited = true;
+        throttle_bucket_sizes(bkt, &bucket_size, &burst_bucket_size);
+        if (bkt->level > bucket_size / 2) {
+            return false;
+        }
+        if (bkt->burst_length > 1 &&
+            bkt->burst_level > burst_bucket_size / 2) {
+            return false;
+        }
+    }
+
+    return limited;
+}
+
 /* compute the timer for this type of operation
  *
  * @direction:  throttle direction
@@ -177,13 +245,8 @@ static bool throttle_compute_timer(ThrottleState *ts,
                                    int64_t now,
                                    int64_t *next_timestamp)
 {
-    int64_t wait;
-
-    /* leak proportionally to the time elapsed */
-    throttle_do_leak(ts, now);
-
     /* compute the wait time if any */
-    wait = throttle_compute_wait_for(ts, direction);
+    int64_t wait = throttle_compute_wait_at(ts, direction, now);
 
     /* if the code must wait compute when the next timer should fire */
     if (wait) {